@@ -0,0 +1,174 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * aggregate.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "util.h"
+#include "control.h"
+#include "metrics.h"
+#include "devread.h"
+#include "aggregate.h"
+
+#define MAX_AGGREGATES 64
+
+struct aggregate {
+    int client;                 // -1 if the slot is free
+    char key[DEVREAD_KEY_MAX + 1];
+    long long window;           // msec
+    long long window_end;
+    unsigned long n;
+    double min;
+    double max;
+    double sum;
+    double last;
+};
+
+struct aggregate_stats aggregate_stats;
+
+static struct aggregate aggregates[MAX_AGGREGATES];
+static int nb_aggregates = 0;   // Slots in use are among the first ones
+
+static struct aggregate *find(int client, const char *key) {
+    for (int i = 0; i < nb_aggregates; ++i) {
+        if (aggregates[i].client == client && !strcmp(aggregates[i].key, key))
+            return &aggregates[i];
+    }
+    return NULL;
+}
+
+static void reset_window(struct aggregate *a) {
+    a->n = 0;
+    a->sum = 0;
+}
+
+int aggregate_add(int client, const char *key, long long window_ms,
+                  long long now) {
+    struct aggregate *a;
+    if ((a = find(client, key)) == NULL) {
+        int i;
+        for (i = 0; i < nb_aggregates && aggregates[i].client != -1; ++i)
+            ;
+        if (i == MAX_AGGREGATES)
+            return -1;
+        if (i == nb_aggregates)
+            ++nb_aggregates;
+        a = &aggregates[i];
+        a->client = client;
+        s_strncpy(a->key, key, sizeof(a->key));
+        ++aggregate_stats.subscriptions;
+    }
+    a->window = window_ms;
+    a->window_end = now + window_ms;
+    reset_window(a);
+    return 0;
+}
+
+static void remove_slot(struct aggregate *a) {
+    a->client = -1;
+    --aggregate_stats.subscriptions;
+    while (nb_aggregates && aggregates[nb_aggregates - 1].client == -1)
+        --nb_aggregates;
+}
+
+int aggregate_remove(int client, const char *key) {
+    struct aggregate *a;
+    if ((a = find(client, key)) == NULL)
+        return -1;
+    remove_slot(a);
+    return 0;
+}
+
+void aggregate_sample(const char *key, double value) {
+    for (int i = 0; i < nb_aggregates; ++i) {
+        struct aggregate *a = &aggregates[i];
+        if (a->client == -1 || strcmp(a->key, key))
+            continue;
+        if (!a->n || value < a->min)
+            a->min = value;
+        if (!a->n || value > a->max)
+            a->max = value;
+        a->sum += value;
+        a->last = value;
+        ++a->n;
+        ++aggregate_stats.samples;
+    }
+}
+
+long long aggregate_flush(long long now) {
+    long long next = -1;
+    for (int i = 0; i < nb_aggregates; ++i) {
+        struct aggregate *a = &aggregates[i];
+        if (a->client == -1)
+            continue;
+        if (!control_alive(a->client)) {
+            remove_slot(a);
+            continue;
+        }
+        if (now >= a->window_end) {
+            if (a->n) {
+                if (control_push(a->client, "%s n=%lu min=%g max=%g mean=%g "
+                                 "last=%g\n", a->key, a->n, a->min, a->max,
+                                 a->sum / a->n, a->last))
+                    ++aggregate_stats.lost;
+                else
+                    ++aggregate_stats.summaries;
+            }
+            reset_window(a);
+                // Windows keep their period, unless the loop was late
+            a->window_end += a->window;
+            if (a->window_end <= now)
+                a->window_end = now + a->window;
+        }
+        if (next == -1 || a->window_end < next)
+            next = a->window_end;
+    }
+    return next;
+}
+
+void aggregate_write_metrics() {
+    if (!aggregate_stats.subscriptions && !aggregate_stats.summaries)
+        return;
+
+    metrics_printf("# HELP mapper_devusb_aggregate_subscriptions Aggregation "
+                   "windows clients subscribed to\n");
+    metrics_printf("# TYPE mapper_devusb_aggregate_subscriptions gauge\n");
+    metrics_printf("mapper_devusb_aggregate_subscriptions %lu\n",
+                   aggregate_stats.subscriptions);
+    metrics_printf("# HELP mapper_devusb_aggregate_samples_total Values added "
+                   "to a window\n");
+    metrics_printf("# TYPE mapper_devusb_aggregate_samples_total counter\n");
+    metrics_printf("mapper_devusb_aggregate_samples_total %lu\n",
+                   aggregate_stats.samples);
+    metrics_printf("# HELP mapper_devusb_aggregate_summaries_total Summaries "
+                   "sent to subscribers\n");
+    metrics_printf("# TYPE mapper_devusb_aggregate_summaries_total counter\n");
+    metrics_printf("mapper_devusb_aggregate_summaries_total %lu\n",
+                   aggregate_stats.summaries);
+    metrics_printf("# HELP mapper_devusb_aggregate_lost_total Summaries lost "
+                   "as the subscriber did not keep up\n");
+    metrics_printf("# TYPE mapper_devusb_aggregate_lost_total counter\n");
+    metrics_printf("mapper_devusb_aggregate_lost_total %lu\n",
+                   aggregate_stats.lost);
+}
@@ -0,0 +1,68 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * aggregate.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+/*
+ * Summaries of the values the board prints, per subscription (control command
+ * subscribe).
+ *
+ * A subscription is a key and a window (ms). Every sample of the key updates
+ * the min, max, sum and last value of the window in place; when the window
+ * ends, the subscriber gets one line:
+ *   KEY n=<samples> min=<v> max=<v> mean=<v> last=<v>
+ * Windows without samples are not reported. A subscriber that does not keep
+ * up loses summaries, it does not slow the daemon down.
+*/
+
+struct aggregate_stats {
+    unsigned long subscriptions;
+    unsigned long samples;      // Counted once per subscription
+    unsigned long summaries;    // Sent
+    unsigned long lost;         // Subscriber not keeping up
+};
+
+extern struct aggregate_stats aggregate_stats;
+
+    // client as given by control_client(). Replaces the window of an existing
+    // subscription of client to key.
+    // Returns 0 on success, -1 if there are too many subscriptions.
+int aggregate_add(int client, const char *key, long long window_ms,
+                  long long now);
+    // Returns 0 on success, -1 if client is not subscribed to key
+int aggregate_remove(int client, const char *key);
+
+    // For every value read from the device
+void aggregate_sample(const char *key, double value);
+
+    // Sends the summaries of the windows that ended, forgets subscriptions of
+    // clients that left. Returns the time (msec) the next window ends, -1 if
+    // none.
+long long aggregate_flush(long long now);
+
+void aggregate_write_metrics();
+
+#endif // AGGREGATE_H
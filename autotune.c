@@ -0,0 +1,205 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * autotune.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "util.h"
+#include "metrics.h"
+#include "autotune.h"
+
+    // The bucket holds at most this many ms of tokens
+#define BURST 100
+    // Rate increase, fraction of the maximum rate
+#define STEP_DIVISOR 16
+    // Rate decrease, in percent of the current rate
+#define DECREASE_PCT 70
+
+struct autotune_stats autotune_stats;
+
+static int enabled = 0;
+static double line_rate;
+static long target;
+static unsigned long min_rate;
+static unsigned long max_rate;
+static unsigned long max_batch;
+
+    // May be negative: a message is written as soon as there are tokens, and
+    // what it takes beyond them delays the next one.
+static double tokens = 0;
+static long long refilled = -1;     // msec
+
+static long long period_start = -1;
+static double latency_sum = 0;
+static unsigned long latency_samples = 0;
+static unsigned long long period_bytes = 0;
+    // Writes were paced during the period
+static int held_back = 0;
+
+void autotune_init(unsigned long rate) {
+    line_rate = rate;
+    enabled = 1;
+}
+
+int autotune_enabled() {
+    return enabled;
+}
+
+static unsigned long clamp(unsigned long v, unsigned long min,
+                           unsigned long max) {
+    return (v < min ? min : (v > max ? max : v));
+}
+
+void autotune_configure(long latency, long rate_min, long rate_max,
+                        long batch_max) {
+    target = latency;
+    min_rate = rate_min;
+    max_rate = (rate_max > rate_min ? rate_max : rate_min);
+    max_batch = batch_max;
+        // Starts at full speed, latency brings it down if needed
+    if (!autotune_stats.rate)
+        autotune_stats.rate = max_rate;
+    autotune_stats.rate = clamp(autotune_stats.rate, min_rate, max_rate);
+    autotune_stats.batch = clamp(autotune_stats.batch, 1, max_batch);
+}
+
+static void refill(long long now) {
+    double burst = autotune_stats.rate * BURST / 1000.0;
+    if (refilled == -1) {
+        tokens = burst;
+    } else if (now > refilled) {
+        tokens += autotune_stats.rate * (now - refilled) / 1000.0;
+        if (tokens > burst)
+            tokens = burst;
+    }
+    refilled = now;
+}
+
+int autotune_take(size_t len, long long now) {
+    if (!enabled)
+        return 1;
+    refill(now);
+    if (tokens <= 0) {
+        ++autotune_stats.throttled;
+        held_back = 1;
+        return 0;
+    }
+    tokens -= len;
+    return 1;
+}
+
+long long autotune_ready_at(long long now) {
+    if (!enabled)
+        return -1;
+    refill(now);
+    if (tokens > 0)
+        return -1;
+    held_back = 1;
+    return now + (long long)(-tokens * 1000 / autotune_stats.rate) + 1;
+}
+
+    // AIMD, once per period
+static void adjust(long long now) {
+    autotune_stats.latency = latency_sum / latency_samples;
+    if (autotune_stats.latency > (unsigned long)target) {
+        unsigned long rate = autotune_stats.rate * DECREASE_PCT / 100;
+        unsigned long taken = period_bytes * 1000 / (now - period_start);
+        autotune_stats.rate = clamp(taken < rate ? taken : rate, min_rate,
+                                    max_rate);
+        autotune_stats.batch = clamp(autotune_stats.batch / 2, 1, max_batch);
+        ++autotune_stats.decreases;
+        DBG("autotune: latency %lu ms, rate down to %lu bytes/s, batch %lu",
+            autotune_stats.latency, autotune_stats.rate, autotune_stats.batch);
+    } else if (held_back && (autotune_stats.rate < max_rate
+                             || autotune_stats.batch < max_batch)) {
+        unsigned long step = max_rate / STEP_DIVISOR;
+        autotune_stats.rate = clamp(autotune_stats.rate + (step ? step : 1),
+                                    min_rate, max_rate);
+        autotune_stats.batch = clamp(autotune_stats.batch + 1, 1, max_batch);
+        ++autotune_stats.increases;
+        DBG("autotune: latency %lu ms, rate up to %lu bytes/s, batch %lu",
+            autotune_stats.latency, autotune_stats.rate, autotune_stats.batch);
+    }
+}
+
+void autotune_observe(size_t len, long long duration, int outq,
+                      long long now) {
+    if (!enabled)
+        return;
+    autotune_stats.outq = outq;
+    period_bytes += len;
+    latency_sum += duration / 1000.0 + outq * 1000.0 / line_rate;
+    ++latency_samples;
+    if (period_start == -1)
+        period_start = now;
+    if (now - period_start < AUTOTUNE_PERIOD)
+        return;
+
+    adjust(now);
+    period_start = now;
+    period_bytes = 0;
+    latency_sum = 0;
+    latency_samples = 0;
+    held_back = 0;
+}
+
+void autotune_write_metrics() {
+    if (!enabled)
+        return;
+
+    metrics_printf("# HELP mapper_devusb_autotune_rate_bytes Bytes per second "
+                   "written to the device at most\n");
+    metrics_printf("# TYPE mapper_devusb_autotune_rate_bytes gauge\n");
+    metrics_printf("mapper_devusb_autotune_rate_bytes %lu\n",
+                   autotune_stats.rate);
+    metrics_printf("# HELP mapper_devusb_autotune_batch Queued messages "
+                   "written at once at most\n");
+    metrics_printf("# TYPE mapper_devusb_autotune_batch gauge\n");
+    metrics_printf("mapper_devusb_autotune_batch %lu\n", autotune_stats.batch);
+    metrics_printf("# HELP mapper_devusb_autotune_latency_ms Time written "
+                   "data waits before reaching the board, mean of the last "
+                   "period\n");
+    metrics_printf("# TYPE mapper_devusb_autotune_latency_ms gauge\n");
+    metrics_printf("mapper_devusb_autotune_latency_ms %lu\n",
+                   autotune_stats.latency);
+    metrics_printf("# HELP mapper_devusb_autotune_outq_bytes Bytes left in "
+                   "the output buffer after the last write\n");
+    metrics_printf("# TYPE mapper_devusb_autotune_outq_bytes gauge\n");
+    metrics_printf("mapper_devusb_autotune_outq_bytes %lu\n",
+                   autotune_stats.outq);
+    metrics_printf("# HELP mapper_devusb_autotune_increases_total Rate "
+                   "increases\n");
+    metrics_printf("# TYPE mapper_devusb_autotune_increases_total counter\n");
+    metrics_printf("mapper_devusb_autotune_increases_total %lu\n",
+                   autotune_stats.increases);
+    metrics_printf("# HELP mapper_devusb_autotune_decreases_total Rate "
+                   "decreases, latency being over the target\n");
+    metrics_printf("# TYPE mapper_devusb_autotune_decreases_total counter\n");
+    metrics_printf("mapper_devusb_autotune_decreases_total %lu\n",
+                   autotune_stats.decreases);
+    metrics_printf("# HELP mapper_devusb_autotune_throttled_total Messages "
+                   "queued to keep to the rate\n");
+    metrics_printf("# TYPE mapper_devusb_autotune_throttled_total counter\n");
+    metrics_printf("mapper_devusb_autotune_throttled_total %lu\n",
+                   autotune_stats.throttled);
+}
@@ -0,0 +1,85 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * autotune.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stddef.h>
+
+/*
+ * Pacing of the writes to the device (option autotune), to write as fast as
+ * the device takes it while what is written waits at most a target latency
+ * before reaching the board.
+ *
+ * Writes go through a token bucket (bytes per second): a message that finds
+ * it empty is queued (see queue.h), and queued messages are then written as
+ * tokens come back, up to the batch size at once, in a single write.
+ * After every write, the bytes left in the tty output buffer (TIOCOUTQ, at
+ * the line rate) plus the time the write took tell how long data waits.
+ * Once per AUTOTUNE_PERIOD, the rate and the batch size grow by a step if
+ * that stayed under the target while the bucket held writes back, and are
+ * cut by a factor as soon as it went over (the rate down to what the device
+ * took over the period, if lower).
+*/
+
+#define AUTOTUNE_PERIOD 1000    // ms
+
+struct autotune_stats {
+    unsigned long rate;         // Bytes per second
+    unsigned long batch;        // Messages per write
+    unsigned long latency;      // ms, mean of the last period
+    unsigned long outq;         // Bytes left in the output buffer, last write
+    unsigned long increases;
+    unsigned long decreases;
+    unsigned long throttled;    // Messages queued for lack of tokens
+};
+
+extern struct autotune_stats autotune_stats;
+
+    // line_rate: bytes per second the serial line carries
+void autotune_init(unsigned long line_rate);
+int autotune_enabled();
+
+    // Bounds of the rate (bytes per second) and of the batch size, and target
+    // latency (ms). Rate and batch size are brought within the bounds.
+void autotune_configure(long latency, long rate_min, long rate_max,
+                        long batch_max);
+
+    // Returns 1 if len bytes may be written now (tokens taken), 0 if the
+    // message must wait
+int autotune_take(size_t len, long long now);
+    // For the messages in the queue: returns the time (msec) tokens are back,
+    // -1 if they are now (or if writes are not paced)
+long long autotune_ready_at(long long now);
+
+    // A write of len bytes to the device took duration usec, leaving outq
+    // bytes in the output buffer
+void autotune_observe(size_t len, long long duration, int outq,
+                      long long now);
+
+void autotune_write_metrics();
+
+#endif // AUTOTUNE_H
@@ -0,0 +1,136 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * busypoll.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <string.h>
+#include <sys/prctl.h>
+
+#include "util.h"
+#include "metrics.h"
+#include "busypoll.h"
+
+struct busypoll_stats busypoll_stats;
+
+static long long spin_budget = 0;
+
+int busypoll_init(long budget) {
+    spin_budget = budget;
+        // 0 would restore the default
+    return prctl(PR_SET_TIMERSLACK, 1UL);
+}
+
+    // Polls until an fd is ready or until end (usec).
+    // Returns the result of the last select(), 0 if nothing got ready.
+static int spin(int nfds, fd_set *rfds, fd_set *wfds, long long end) {
+    long long start = now_usec();
+    long long t;
+    int n;
+    do {
+        fd_set r;
+        fd_set w;
+        struct timeval zero = { 0, 0 };
+        memcpy(&r, rfds, sizeof(r));
+        memcpy(&w, wfds, sizeof(w));
+        n = select(nfds, &r, &w, NULL, &zero);
+        ++busypoll_stats.polls;
+        t = now_usec();
+        if (n > 0) {
+            memcpy(rfds, &r, sizeof(r));
+            memcpy(wfds, &w, sizeof(w));
+            ++busypoll_stats.hits;
+        }
+    } while (!n && t < end);
+    busypoll_stats.spin_usec += t - start;
+    return n;
+}
+
+int busypoll_select(int nfds, fd_set *rfds, fd_set *wfds, long long timeout) {
+    struct timeval tv;
+    if (!spin_budget) {
+        tv.tv_sec = timeout / 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+        return select(nfds, rfds, wfds, NULL, &tv);
+    }
+
+    long long start = now_usec();
+    long long deadline = start + timeout * 1000;
+    long long end = start + spin_budget;
+    int n;
+    if ((n = spin(nfds, rfds, wfds, end < deadline ? end : deadline)))
+        return n;
+    long long now = now_usec();
+    if (now >= deadline) {
+        FD_ZERO(rfds);
+        FD_ZERO(wfds);
+        return 0;
+    }
+
+    ++busypoll_stats.sleeps;
+    tv.tv_sec = (deadline - now) / 1000000;
+    tv.tv_usec = (deadline - now) % 1000000;
+    if ((n = select(nfds, rfds, wfds, NULL, &tv)) == 0) {
+        long long late = now_usec() - deadline;
+        ++busypoll_stats.timeouts;
+        if (late > 0)
+            busypoll_stats.late_usec += late;
+    }
+    return n;
+}
+
+void busypoll_write_metrics() {
+    if (!spin_budget)
+        return;
+
+    metrics_printf("# HELP mapper_devusb_busy_poll_hits_total Waits ended "
+                   "while spinning, without a wakeup\n");
+    metrics_printf("# TYPE mapper_devusb_busy_poll_hits_total counter\n");
+    metrics_printf("mapper_devusb_busy_poll_hits_total %lu\n",
+                   busypoll_stats.hits);
+    metrics_printf("# HELP mapper_devusb_busy_poll_sleeps_total Waits that "
+                   "blocked, spin budget spent\n");
+    metrics_printf("# TYPE mapper_devusb_busy_poll_sleeps_total counter\n");
+    metrics_printf("mapper_devusb_busy_poll_sleeps_total %lu\n",
+                   busypoll_stats.sleeps);
+    metrics_printf("# HELP mapper_devusb_busy_poll_spin_seconds_total CPU "
+                   "time spent spinning\n");
+    metrics_printf("# TYPE mapper_devusb_busy_poll_spin_seconds_total "
+                   "counter\n");
+    metrics_printf("mapper_devusb_busy_poll_spin_seconds_total %.6f\n",
+                   busypoll_stats.spin_usec / 1e6);
+    metrics_printf("# HELP mapper_devusb_busy_poll_poll_seconds Mean time "
+                   "between two polls, the longest an fd waits while "
+                   "spinning\n");
+    metrics_printf("# TYPE mapper_devusb_busy_poll_poll_seconds gauge\n");
+    metrics_printf("mapper_devusb_busy_poll_poll_seconds %.9f\n",
+                   busypoll_stats.polls ? busypoll_stats.spin_usec / 1e6
+                   / busypoll_stats.polls : 0);
+    metrics_printf("# HELP mapper_devusb_busy_poll_wakeup_seconds Mean time "
+                   "blocking waits overran their timeout, what a wakeup "
+                   "costs\n");
+    metrics_printf("# TYPE mapper_devusb_busy_poll_wakeup_seconds gauge\n");
+    metrics_printf("mapper_devusb_busy_poll_wakeup_seconds %.9f\n",
+                   busypoll_stats.timeouts ? busypoll_stats.late_usec / 1e6
+                   / busypoll_stats.timeouts : 0);
+}
@@ -0,0 +1,69 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * busypoll.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef BUSYPOLL_H
+#define BUSYPOLL_H
+
+#include <sys/select.h>
+
+/*
+ * Waiting for the fds of the main loop (option busy_poll), for a daemon that
+ * has a core of its own.
+ *
+ * Instead of sleeping in select() right away, the fds are polled (select()
+ * with a zero timeout) over and over for the spin budget, so that a message
+ * is picked up without waiting for the scheduler to wake the daemon up. Once
+ * the budget is spent, select() blocks as usual.
+ *
+ * What it costs is the time spent spinning. What it gains is the delay of a
+ * wakeup, which the time blocking waits overran their timeout tells, against
+ * the time between two polls. The kernel timer slack of the daemon is set to
+ * 1 ns, its minimum, so that a wakeup is not deferred on purpose: the overrun
+ * is then the wakeup latency of the scheduler, not the slack.
+*/
+
+struct busypoll_stats {
+    unsigned long hits;             // Waits ended while spinning
+    unsigned long sleeps;           // Waits that blocked, budget spent
+    unsigned long long polls;
+    unsigned long long spin_usec;
+    unsigned long timeouts;         // Blocking waits that timed out
+    unsigned long long late_usec;   // By how much they overran, in total
+};
+
+extern struct busypoll_stats busypoll_stats;
+
+    // budget: usec to spin for, 0 to always block
+    // Returns 0 on success, -1 if the timer slack could not be set (errno
+    // set)
+int busypoll_init(long budget);
+
+    // Same as select(), the timeout being in ms
+int busypoll_select(int nfds, fd_set *rfds, fd_set *wfds, long long timeout);
+
+void busypoll_write_metrics();
+
+#endif // BUSYPOLL_H
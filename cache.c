@@ -0,0 +1,185 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * cache.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "util.h"
+#include "metrics.h"
+#include "devread.h"
+#include "cache.h"
+
+#define NO_ENTRY -1
+
+struct entry {
+    char key[DEVREAD_KEY_MAX + 1];
+    char line[DEVREAD_LINE_MAX + 1];
+    long long updated;          // msec
+    int next;                   // In the bucket
+    int older, newer;           // In the LRU list
+};
+
+struct cache_stats cache_stats;
+
+static struct entry *entries = NULL;
+static int *buckets;
+static size_t nb_entries;       // Capacity
+    // Least and most recently updated entries
+static int oldest = NO_ENTRY;
+static int newest = NO_ENTRY;
+
+int cache_init(size_t size) {
+    if ((entries = calloc(size, sizeof(*entries))) == NULL
+            || (buckets = malloc(size * sizeof(*buckets))) == NULL) {
+        free(entries);
+        entries = NULL;
+        return -1;
+    }
+    for (size_t i = 0; i < size; ++i)
+        buckets[i] = NO_ENTRY;
+    nb_entries = size;
+    return 0;
+}
+
+int cache_enabled() {
+    return entries != NULL;
+}
+
+    // FNV-1a
+static size_t hash(const char *key) {
+    uint32_t h = 2166136261U;
+    for (; *key; ++key)
+        h = (h ^ (unsigned char)*key) * 16777619U;
+    return h % nb_entries;
+}
+
+static struct entry *find(const char *key) {
+    for (int e = buckets[hash(key)]; e != NO_ENTRY; e = entries[e].next) {
+        if (!strcmp(entries[e].key, key))
+            return &entries[e];
+    }
+    return NULL;
+}
+
+static void unlink_entry(int e) {
+    int *p = &buckets[hash(entries[e].key)];
+    while (*p != e)
+        p = &entries[*p].next;
+    *p = entries[e].next;
+}
+
+static void lru_remove(int e) {
+    struct entry *ent = &entries[e];
+    if (ent->older != NO_ENTRY)
+        entries[ent->older].newer = ent->newer;
+    else
+        oldest = ent->newer;
+    if (ent->newer != NO_ENTRY)
+        entries[ent->newer].older = ent->older;
+    else
+        newest = ent->older;
+}
+
+static void lru_append(int e) {
+    entries[e].older = newest;
+    entries[e].newer = NO_ENTRY;
+    if (newest != NO_ENTRY)
+        entries[newest].newer = e;
+    else
+        oldest = e;
+    newest = e;
+}
+
+    // Returns a free entry, out of the LRU list, evicting the oldest one if
+    // needed
+static int new_entry() {
+    if (cache_stats.entries < nb_entries)
+        return cache_stats.entries++;
+
+    int e = oldest;
+    lru_remove(e);
+    unlink_entry(e);
+    ++cache_stats.evictions;
+    return e;
+}
+
+void cache_update(const char *key, const char *line, size_t len,
+                  long long now) {
+    if (!entries)
+        return;
+
+    struct entry *ent;
+    if ((ent = find(key)) == NULL) {
+        int e = new_entry();
+        ent = &entries[e];
+        s_strncpy(ent->key, key, sizeof(ent->key));
+        size_t b = hash(key);
+        ent->next = buckets[b];
+        buckets[b] = e;
+    } else {
+        lru_remove(ent - entries);
+    }
+        // Updates come in time order, the list stays sorted by updated
+    lru_append(ent - entries);
+    if (len > DEVREAD_LINE_MAX)
+        len = DEVREAD_LINE_MAX;
+    memcpy(ent->line, line, len);
+    ent->line[len] = '\0';
+    ent->updated = now;
+}
+
+const char *cache_lookup(const char *key, long long max_age, long long now) {
+    const struct entry *ent;
+    if (entries && (ent = find(key)) != NULL && now - ent->updated <= max_age) {
+        ++cache_stats.hits;
+        return ent->line;
+    }
+    ++cache_stats.misses;
+    return NULL;
+}
+
+void cache_write_metrics() {
+    if (!entries)
+        return;
+
+    metrics_printf("# HELP mapper_devusb_cache_hits_total Reads answered from "
+                   "the cache\n");
+    metrics_printf("# TYPE mapper_devusb_cache_hits_total counter\n");
+    metrics_printf("mapper_devusb_cache_hits_total %lu\n", cache_stats.hits);
+    metrics_printf("# HELP mapper_devusb_cache_misses_total Reads that needed "
+                   "a device query\n");
+    metrics_printf("# TYPE mapper_devusb_cache_misses_total counter\n");
+    metrics_printf("mapper_devusb_cache_misses_total %lu\n",
+                   cache_stats.misses);
+    metrics_printf("# HELP mapper_devusb_cache_entries Keys in the cache\n");
+    metrics_printf("# TYPE mapper_devusb_cache_entries gauge\n");
+    metrics_printf("mapper_devusb_cache_entries %lu\n", cache_stats.entries);
+    metrics_printf("# HELP mapper_devusb_cache_evictions_total Keys removed "
+                   "to make room\n");
+    metrics_printf("# TYPE mapper_devusb_cache_evictions_total counter\n");
+    metrics_printf("mapper_devusb_cache_evictions_total %lu\n",
+                   cache_stats.evictions);
+}
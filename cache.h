@@ -0,0 +1,61 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * cache.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+
+#include "devread.h"
+
+/*
+ * Latest line printed by the board, per key (control command get).
+ *
+ * When the cache is full, the entry updated the longest ago makes room.
+*/
+
+struct cache_stats {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long entries;
+    unsigned long evictions;
+};
+
+extern struct cache_stats cache_stats;
+
+    // Returns 0 on success, -1 on error (errno set)
+int cache_init(size_t size);
+int cache_enabled();
+
+void cache_update(const char *key, const char *line, size_t len,
+                  long long now);
+
+    // Returns the line of key if updated at most max_age ms ago, NULL
+    // otherwise
+const char *cache_lookup(const char *key, long long max_age, long long now);
+
+void cache_write_metrics();
+
+#endif // CACHE_H
@@ -0,0 +1,179 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * client_fifo.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "util.h"
+#include "metrics.h"
+#include "client_fifo.h"
+
+struct client_fifo client_fifos[MAX_CLIENT_FIFOS];
+
+static char fifo_dir[PATH_MAX];
+static long long idle_timeout;      // msec
+
+void client_fifo_init(const char *dir, int idle_sec) {
+    s_strncpy(fifo_dir, dir, sizeof(fifo_dir));
+    idle_timeout = idle_sec * 1000LL;
+    for (int i = 0; i < MAX_CLIENT_FIFOS; ++i)
+        client_fifos[i].fd = -1;
+}
+
+void client_fifo_path(const struct client_fifo *c, char *path, size_t size) {
+    snprintf(path, size, "%s/%s.fifo", fifo_dir, c->name);
+}
+
+struct client_fifo *client_fifo_find(const char *name) {
+    for (int i = 0; i < MAX_CLIENT_FIFOS; ++i) {
+        if (client_fifos[i].fd != -1 && !strcmp(client_fifos[i].name, name))
+            return &client_fifos[i];
+    }
+    return NULL;
+}
+
+struct client_fifo *client_fifo_open(const char *name) {
+    struct client_fifo *c;
+
+    if (!valid_name(name, CLIENT_FIFO_NAME_MAX)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((c = client_fifo_find(name)) != NULL) {
+        c->last_activity = now_msec();
+        return c;
+    }
+
+    for (c = client_fifos; c < client_fifos + MAX_CLIENT_FIFOS; ++c) {
+        if (c->fd == -1)
+            break;
+    }
+    if (c == client_fifos + MAX_CLIENT_FIFOS) {
+        errno = EMFILE;
+        return NULL;
+    }
+
+    s_strncpy(c->name, name, sizeof(c->name));
+    char path[PATH_MAX + CLIENT_FIFO_NAME_MAX + 8];
+    client_fifo_path(c, path, sizeof(path));
+    unlink(path);
+        // Group members (the producers) may write
+    if (mkfifo(path, 0600) || chmod(path, 0620))
+        return NULL;
+        // Read-write, as the main FIFO: no end-of-file when writers leave
+    if ((c->fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC)) == -1) {
+        unlink(path);
+        return NULL;
+    }
+    c->messages = 0;
+    c->bytes = 0;
+    c->last_activity = now_msec();
+    l("client fifo '%s' created", path);
+
+    return c;
+}
+
+void client_fifo_close(struct client_fifo *c) {
+    char path[PATH_MAX + CLIENT_FIFO_NAME_MAX + 8];
+    client_fifo_path(c, path, sizeof(path));
+    close(c->fd);
+    c->fd = -1;
+    unlink(path);
+    l("client fifo '%s' removed (%lu message(s), %lu bytes)", path,
+      c->messages, c->bytes);
+}
+
+void client_fifo_close_all() {
+    for (int i = 0; i < MAX_CLIENT_FIFOS; ++i) {
+        if (client_fifos[i].fd != -1)
+            client_fifo_close(&client_fifos[i]);
+    }
+}
+
+int client_fifo_fds(fd_set *rfds) {
+    int max_fd = -1;
+    for (int i = 0; i < MAX_CLIENT_FIFOS; ++i) {
+        int fd = client_fifos[i].fd;
+        if (fd == -1)
+            continue;
+        FD_SET(fd, rfds);
+        if (fd > max_fd)
+            max_fd = fd;
+    }
+    return max_fd;
+}
+
+long long client_fifo_expire(long long now) {
+    long long next = -1;
+    for (int i = 0; i < MAX_CLIENT_FIFOS; ++i) {
+        struct client_fifo *c = &client_fifos[i];
+        if (c->fd == -1)
+            continue;
+        long long expiry = c->last_activity + idle_timeout;
+        if (now >= expiry)
+            client_fifo_close(c);
+        else if (next == -1 || expiry < next)
+            next = expiry;
+    }
+    return next;
+}
+
+void client_fifo_write_metrics() {
+    int header = 0;
+    for (int i = 0; i < MAX_CLIENT_FIFOS; ++i) {
+        const struct client_fifo *c = &client_fifos[i];
+        if (c->fd == -1)
+            continue;
+        if (!header) {
+            metrics_printf("# HELP mapper_devusb_client_messages_total "
+                           "Messages received on client FIFOs\n");
+            metrics_printf("# TYPE mapper_devusb_client_messages_total "
+                           "counter\n");
+            header = 1;
+        }
+        metrics_printf("mapper_devusb_client_messages_total{client=\"%s\"} "
+                       "%lu\n", c->name, c->messages);
+    }
+    header = 0;
+    for (int i = 0; i < MAX_CLIENT_FIFOS; ++i) {
+        const struct client_fifo *c = &client_fifos[i];
+        if (c->fd == -1)
+            continue;
+        if (!header) {
+            metrics_printf("# HELP mapper_devusb_client_received_bytes_total "
+                           "Bytes received on client FIFOs\n");
+            metrics_printf("# TYPE mapper_devusb_client_received_bytes_total "
+                           "counter\n");
+            header = 1;
+        }
+        metrics_printf("mapper_devusb_client_received_bytes_total"
+                       "{client=\"%s\"} %lu\n", c->name, c->bytes);
+    }
+}
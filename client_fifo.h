@@ -0,0 +1,72 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * client_fifo.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef CLIENT_FIFO_H
+#define CLIENT_FIFO_H
+
+#include <sys/select.h>
+
+/*
+ * Private FIFOs, created on request of producers (control command fifo), so
+ * that their writes do not interleave with others', and accounted for
+ * separately. A FIFO nobody wrote to for the idle timeout is removed.
+ *
+ * FIFOs are named <name>.fifo, in the directory of the control socket.
+*/
+
+#define MAX_CLIENT_FIFOS 32
+#define CLIENT_FIFO_NAME_MAX 32
+
+struct client_fifo {
+    char name[CLIENT_FIFO_NAME_MAX + 1];
+    int fd;                     // -1 if the slot is free
+    unsigned long messages;
+    unsigned long bytes;
+    long long last_activity;    // msec
+};
+
+extern struct client_fifo client_fifos[MAX_CLIENT_FIFOS];
+
+void client_fifo_init(const char *dir, int idle_sec);
+
+    // Creates FIFO name, or gives it another idle timeout if it exists.
+    // Returns it, NULL on error (errno set).
+struct client_fifo *client_fifo_open(const char *name);
+struct client_fifo *client_fifo_find(const char *name);
+void client_fifo_close(struct client_fifo *c);
+void client_fifo_close_all();
+
+void client_fifo_path(const struct client_fifo *c, char *path, size_t size);
+
+    // Adds the FIFOs to watch to rfds, returns the highest one, -1 if none
+int client_fifo_fds(fd_set *rfds);
+
+    // Removes idle FIFOs, returns the time (msec) the next one would expire,
+    // -1 if there is no FIFO.
+long long client_fifo_expire(long long now);
+
+void client_fifo_write_metrics();
+
+#endif // CLIENT_FIFO_H
@@ -0,0 +1,340 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * control.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "util.h"
+#include "control.h"
+
+#define MAX_CLIENTS 16
+#define MAX_LINE 512
+    // Of what is sent: device lines and their topic
+#define MAX_OUT_LINE 1024
+#define MAX_ARGS 16
+    // What a client has not read yet, beyond its socket buffer
+#define OUT_SIZE 16384
+    // Pushed lines fill no more, replies still fit behind them
+#define PUSH_ROOM (OUT_SIZE / 2)
+
+struct client {
+    int fd;
+    unsigned gen;           // Tells apart successive clients of a slot
+    size_t len;
+    char line[MAX_LINE];
+    size_t out_head;        // Next byte to send
+    size_t out_len;
+    char out[OUT_SIZE];
+};
+
+static int listen_fd = -1;
+static char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static control_handler_t handler;
+static struct client clients[MAX_CLIENTS];
+static struct client *current = NULL;
+
+int control_open(const char *path, control_handler_t h) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    s_strncpy(addr.sun_path, path, sizeof(addr.sun_path));
+
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+        return -1;
+    unlink(path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr))
+            || chmod(path, 0660) || listen(listen_fd, MAX_CLIENTS)) {
+        int err = errno;
+        close(listen_fd);
+        listen_fd = -1;
+        errno = err;
+        return -1;
+    }
+    s_strncpy(socket_path, path, sizeof(socket_path));
+    handler = h;
+    for (int i = 0; i < MAX_CLIENTS; ++i) {
+        clients[i].fd = -1;
+        clients[i].gen = 0;
+    }
+
+    return 0;
+}
+
+static void drop_client(struct client *c) {
+    close(c->fd);
+    c->fd = -1;
+}
+
+void control_close() {
+    if (listen_fd == -1)
+        return;
+    for (int i = 0; i < MAX_CLIENTS; ++i) {
+        if (clients[i].fd != -1)
+            drop_client(&clients[i]);
+    }
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_path);
+}
+
+int control_fds(fd_set *rfds, fd_set *wfds) {
+    if (listen_fd == -1)
+        return -1;
+
+    int max_fd = listen_fd;
+    FD_SET(listen_fd, rfds);
+    for (int i = 0; i < MAX_CLIENTS; ++i) {
+        if (clients[i].fd == -1)
+            continue;
+        FD_SET(clients[i].fd, rfds);
+        if (clients[i].out_len)
+            FD_SET(clients[i].fd, wfds);
+        if (clients[i].fd > max_fd)
+            max_fd = clients[i].fd;
+    }
+    return max_fd;
+}
+
+    // Sends what the socket of c takes without blocking. Returns 0, -1 if c
+    // got dropped.
+static int flush(struct client *c) {
+    while (c->out_len) {
+        size_t chunk = OUT_SIZE - c->out_head;
+        if (chunk > c->out_len)
+            chunk = c->out_len;
+        ssize_t n = send(c->fd, c->out + c->out_head, chunk,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            drop_client(c);
+            return -1;
+        }
+        c->out_head = (c->out_head + n) % OUT_SIZE;
+        c->out_len -= n;
+    }
+    c->out_head = 0;
+    return 0;
+}
+
+    // Lines go whole to the output of c, and are sent as the socket takes
+    // them: the loop never waits for a client.
+    // Returns 0 if queued, -1 otherwise. If there is no room, a push is lost,
+    // and the client of a reply is dropped (it does not read its replies).
+static int vreply(struct client *c, int push, const char *fmt,
+                  va_list args) {
+    char line[MAX_OUT_LINE];
+    int n = vsnprintf(line, sizeof(line), fmt, args);
+    if (n <= 0)
+        return 0;
+        // Truncated, still a line
+    if (n >= (int)sizeof(line)) {
+        n = sizeof(line) - 1;
+        line[n - 1] = '\n';
+    }
+    if ((push ? PUSH_ROOM : OUT_SIZE) < c->out_len + n) {
+        if (!push) {
+            l("control: client does not read its replies, disconnected");
+            drop_client(c);
+        }
+        return -1;
+    }
+    size_t tail = (c->out_head + c->out_len) % OUT_SIZE;
+    size_t first = OUT_SIZE - tail;
+    if (first > (size_t)n)
+        first = n;
+    memcpy(c->out + tail, line, first);
+    memcpy(c->out, line + first, n - first);
+    c->out_len += n;
+    return flush(c);
+}
+
+void control_printf(const char *fmt, ...) {
+    if (!current || current->fd == -1)
+        return;
+
+    va_list args;
+    va_start(args, fmt);
+    vreply(current, 0, fmt, args);
+    va_end(args);
+}
+
+int control_client() {
+    if (!current)
+        return -1;
+    return (current - clients) + current->gen * MAX_CLIENTS;
+}
+
+static struct client *find_client(int client) {
+    if (client < 0)
+        return NULL;
+    struct client *c = &clients[client % MAX_CLIENTS];
+    if (c->fd == -1 || c->gen != (unsigned)client / MAX_CLIENTS)
+        return NULL;
+    return c;
+}
+
+int control_alive(int client) {
+    return find_client(client) != NULL;
+}
+
+void control_disconnect(int client) {
+    struct client *c;
+    if ((c = find_client(client)) != NULL)
+        drop_client(c);
+}
+
+void control_reply(int client, const char *fmt, ...) {
+    struct client *c;
+    if ((c = find_client(client)) == NULL)
+        return;
+
+    va_list args;
+    va_start(args, fmt);
+    vreply(c, 0, fmt, args);
+    va_end(args);
+}
+
+int control_push(int client, const char *fmt, ...) {
+    struct client *c;
+    if ((c = find_client(client)) == NULL)
+        return -1;
+
+    va_list args;
+    va_start(args, fmt);
+    int r = vreply(c, 1, fmt, args);
+    va_end(args);
+    return r;
+}
+
+    // The line running as typed after its command word, see control_rest()
+static char rest[MAX_LINE];
+
+const char *control_rest() {
+    return rest;
+}
+
+static void run(struct client *c, char *line) {
+    size_t n = strlen(line);
+    if (n && line[n - 1] == '\r')
+        line[--n] = '\0';
+    const char *r = line + strspn(line, " \t");
+    r += strcspn(r, " \t");
+    if (*r)
+        ++r;
+    s_strncpy(rest, r, sizeof(rest));
+
+    char *argv[MAX_ARGS];
+    int argc = 0;
+    char *saveptr;
+    for (char *w = strtok_r(line, " \t\r", &saveptr);
+            w && argc < MAX_ARGS; w = strtok_r(NULL, " \t\r", &saveptr))
+        argv[argc++] = w;
+    if (!argc)
+        return;
+
+    current = c;
+    if (handler(argc, argv) == 0)
+        control_printf("ok\n");
+    current = NULL;
+}
+
+static void accept_client() {
+    int fd;
+    if ((fd = accept(listen_fd, NULL, NULL)) == -1)
+        return;
+
+    struct client *c = NULL;
+    for (int i = 0; i < MAX_CLIENTS; ++i) {
+        if (clients[i].fd == -1) {
+            c = &clients[i];
+            break;
+        }
+    }
+    if (!c) {
+        static const char busy[] = "error: too many clients\n";
+        send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+        close(fd);
+        return;
+    }
+
+    c->fd = fd;
+    c->len = 0;
+    c->out_head = 0;
+    c->out_len = 0;
+    c->gen = (c->gen + 1) % (1U << 16);
+}
+
+static void read_client(struct client *c) {
+    ssize_t n = read(c->fd, c->line + c->len, sizeof(c->line) - c->len - 1);
+    if (n <= 0) {
+        drop_client(c);
+        return;
+    }
+    c->len += n;
+    c->line[c->len] = '\0';
+
+    char *eol;
+    while (c->fd != -1 && (eol = strchr(c->line, '\n')) != NULL) {
+        *eol = '\0';
+        run(c, c->line);
+        if (c->fd == -1)
+            return;
+        c->len -= eol + 1 - c->line;
+        memmove(c->line, eol + 1, c->len + 1);
+    }
+    if (c->len == sizeof(c->line) - 1) {
+        current = c;
+        control_printf("error: line too long\n");
+        current = NULL;
+        if (c->fd != -1)
+            drop_client(c);
+    }
+}
+
+void control_handle(fd_set *rfds, fd_set *wfds) {
+    if (listen_fd == -1)
+        return;
+
+    for (int i = 0; i < MAX_CLIENTS; ++i) {
+        struct client *c = &clients[i];
+        if (c->fd != -1 && FD_ISSET(c->fd, wfds))
+            flush(c);
+        if (c->fd != -1 && FD_ISSET(c->fd, rfds))
+            read_client(c);
+    }
+    if (FD_ISSET(listen_fd, rfds))
+        accept_client();
+}
@@ -0,0 +1,83 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * control.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <sys/select.h>
+
+/*
+ * Admin commands, received on a Unix stream socket.
+ *
+ * One command per line, words separated by blanks. The reply ends with a line
+ * "ok", or "error: <reason>". For instance:
+ *   echo status | socat - UNIX-CONNECT:/run/mapper-devusb/control
+ *
+ * Commands are run by the event loop, between two messages. What is sent to
+ * a client goes through an output buffer of its own, flushed as its socket
+ * accepts it: a client that does not read its replies gets disconnected, it
+ * does not stall the loop.
+*/
+
+    // Runs a command and returns 0 if it succeeded. Otherwise, it replied
+    // with an error line itself, or returns CONTROL_PENDING to reply later
+    // with control_reply().
+typedef int (*control_handler_t)(int argc, char *argv[]);
+#define CONTROL_PENDING 1
+
+    // Returns 0 on success, -1 on error (errno set)
+int control_open(const char *path, control_handler_t handler);
+void control_close();
+
+    // Adds the sockets to watch to rfds, and those with output pending to
+    // wfds. Returns the highest one, -1 if none.
+int control_fds(fd_set *rfds, fd_set *wfds);
+    // Accepts clients, runs their commands and sends their output, for the
+    // sockets set in rfds and wfds
+void control_handle(fd_set *rfds, fd_set *wfds);
+
+    // Replies to the client whose command runs
+void control_printf(const char *fmt, ...)
+     __attribute__((format(printf, 1, 2)));
+
+    // Identifies the client whose command runs, for control_reply()
+int control_client();
+    // What follows the command word and the blank after it, in the line
+    // running, as the client sent it: its words are not limited in number
+    // and its blanks are kept
+const char *control_rest();
+    // Replies to a client later on. Does nothing if it left meanwhile.
+void control_reply(int client, const char *fmt, ...)
+     __attribute__((format(printf, 2, 3)));
+    // Tells whether a client is still connected
+int control_alive(int client);
+void control_disconnect(int client);
+    // Sends a line a client did not ask for right now, without blocking: it
+    // is lost if the output buffer of the client is full. Returns 0 if it
+    // was sent or buffered.
+int control_push(int client, const char *fmt, ...)
+     __attribute__((format(printf, 2, 3)));
+
+#endif // CONTROL_H
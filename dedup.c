@@ -0,0 +1,168 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * dedup.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+
+#include "util.h"
+#include "metrics.h"
+#include "dedup.h"
+
+#define NO_ENTRY -1
+    // As next, for an entry in no bucket
+#define FORGOTTEN -2
+
+struct entry {
+    uint64_t hash;
+    long long added;            // msec
+    int next;                   // In the bucket
+};
+
+struct dedup_stats dedup_stats;
+
+    // entries is a ring, oldest at tail, next one added at head
+static struct entry *entries = NULL;
+static int *buckets;
+static size_t nb_entries;
+static size_t used = 0;         // Entries of the ring, forgotten ones too
+static size_t head = 0;
+static size_t tail = 0;
+static long long window;
+
+int dedup_init(size_t memory, long long window_ms) {
+    size_t size = memory / (sizeof(*entries) + sizeof(*buckets));
+    if (size < 1)
+        size = 1;
+    if ((entries = calloc(size, sizeof(*entries))) == NULL
+            || (buckets = malloc(size * sizeof(*buckets))) == NULL) {
+        free(entries);
+        entries = NULL;
+        return -1;
+    }
+    for (size_t i = 0; i < size; ++i)
+        buckets[i] = NO_ENTRY;
+    nb_entries = size;
+    window = window_ms;
+    return 0;
+}
+
+int dedup_enabled() {
+    return entries != NULL;
+}
+
+    // FNV-1a
+uint64_t dedup_hash(const char *key, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i)
+        h = (h ^ (unsigned char)key[i]) * 1099511628211ULL;
+    return (h ? h : 1);
+}
+
+static void unlink_entry(int e) {
+    int *p = &buckets[entries[e].hash % nb_entries];
+    while (*p != e)
+        p = &entries[*p].next;
+    *p = entries[e].next;
+    entries[e].next = FORGOTTEN;
+    --dedup_stats.keys;
+}
+
+static void remove_oldest() {
+    if (entries[tail].next != FORGOTTEN)
+        unlink_entry(tail);
+    tail = (tail + 1) % nb_entries;
+    --used;
+}
+
+static void expire(long long now) {
+    while (used && now - entries[tail].added >= window)
+        remove_oldest();
+}
+
+int dedup_seen(const char *key, size_t len, long long now) {
+    if (!entries)
+        return 0;
+    expire(now);
+    uint64_t h = dedup_hash(key, len);
+    for (int e = buckets[h % nb_entries]; e != NO_ENTRY; e = entries[e].next) {
+        if (entries[e].hash == h) {
+            ++dedup_stats.duplicates;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void dedup_add(const char *key, size_t len, long long now) {
+    if (!entries)
+        return;
+    expire(now);
+    if (used == nb_entries) {
+        if (entries[tail].next != FORGOTTEN)
+            ++dedup_stats.evictions;
+        remove_oldest();
+    }
+    struct entry *ent = &entries[head];
+    ent->hash = dedup_hash(key, len);
+    ent->added = now;
+    size_t b = ent->hash % nb_entries;
+    ent->next = buckets[b];
+    buckets[b] = head;
+    head = (head + 1) % nb_entries;
+    ++used;
+    ++dedup_stats.keys;
+}
+
+    // The entry stays in the ring until it expires, out of its bucket
+void dedup_forget(uint64_t hash) {
+    if (!entries)
+        return;
+    for (int e = buckets[hash % nb_entries]; e != NO_ENTRY;
+            e = entries[e].next) {
+        if (entries[e].hash == hash) {
+            unlink_entry(e);
+            return;
+        }
+    }
+}
+
+void dedup_write_metrics() {
+    if (!entries)
+        return;
+
+    metrics_printf("# HELP mapper_devusb_dedup_keys Idempotency keys "
+                   "remembered\n");
+    metrics_printf("# TYPE mapper_devusb_dedup_keys gauge\n");
+    metrics_printf("mapper_devusb_dedup_keys %lu\n", dedup_stats.keys);
+    metrics_printf("# HELP mapper_devusb_dedup_duplicates_total Messages not "
+                   "written, their key being known\n");
+    metrics_printf("# TYPE mapper_devusb_dedup_duplicates_total counter\n");
+    metrics_printf("mapper_devusb_dedup_duplicates_total %lu\n",
+                   dedup_stats.duplicates);
+    metrics_printf("# HELP mapper_devusb_dedup_evictions_total Keys forgotten "
+                   "before the end of their window, the table being full\n");
+    metrics_printf("# TYPE mapper_devusb_dedup_evictions_total counter\n");
+    metrics_printf("mapper_devusb_dedup_evictions_total %lu\n",
+                   dedup_stats.evictions);
+}
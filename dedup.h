@@ -0,0 +1,67 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * dedup.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Idempotency keys of the messages recently accepted (options dedup_memory and
+ * dedup_window), so that a producer that retries does not get its message
+ * written twice.
+ *
+ * Keys are remembered by their 64-bit hash, in the order they came: when the
+ * table is full, the oldest key is forgotten before its window ends. The key
+ * of a message cancelled while queued is forgotten, so that the producer can
+ * send it again.
+*/
+
+#define DEDUP_KEY_MAX 64
+
+struct dedup_stats {
+    unsigned long keys;
+    unsigned long duplicates;
+    unsigned long evictions;    // Forgotten before the end of their window
+};
+
+extern struct dedup_stats dedup_stats;
+
+    // Returns 0 on success, -1 on error (errno set)
+int dedup_init(size_t memory, long long window_ms);
+int dedup_enabled();
+
+    // Returns 1 if key (len bytes) was added less than the window ago, 0
+    // otherwise
+int dedup_seen(const char *key, size_t len, long long now);
+void dedup_add(const char *key, size_t len, long long now);
+    // Hash of key (len bytes), as dedup_forget() takes it. Never 0.
+uint64_t dedup_hash(const char *key, size_t len);
+void dedup_forget(uint64_t hash);
+
+void dedup_write_metrics();
+
+#endif // DEDUP_H
@@ -0,0 +1,113 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * devread.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+
+#include "util.h"
+#include "serial_speed.h"
+#include "devread.h"
+
+static int fd = -1;
+static devread_handler_t handler;
+static char line[DEVREAD_LINE_MAX + 1];
+static size_t line_len = 0;
+
+int devread_open(const char *dev, devread_handler_t h) {
+    if (fd != -1)
+        return 0;
+
+    if ((fd = open(dev, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC)) == -1)
+        return -1;
+
+    struct termios term;
+    if (tcgetattr(fd, &term)) {
+        int err = errno;
+        close(fd);
+        fd = -1;
+        errno = err;
+        return -1;
+    }
+    term.c_cflag &= ~HUPCL;
+    term.c_cflag |= CREAD | CLOCAL;
+    term.c_lflag &= ~(ICANON | ECHO | ECHOE | ECHOK | ECHONL | ISIG | IEXTEN);
+    term.c_iflag &= ~(IXON | IXOFF | INLCR | IGNCR | ICRNL);
+    term.c_cc[VMIN] = 1;
+    term.c_cc[VTIME] = 0;
+    cfsetispeed(&term, SERIAL_SPEED_SPEED_T);
+    cfsetospeed(&term, SERIAL_SPEED_SPEED_T);
+    if (tcsetattr(fd, TCSANOW, &term))
+        l("warning: cannot set input mode of '%s': %s", dev, strerror(errno));
+
+    handler = h;
+    line_len = 0;
+    l("reading from '%s'", dev);
+
+    return 0;
+}
+
+void devread_close() {
+    if (fd == -1)
+        return;
+    close(fd);
+    fd = -1;
+}
+
+int devread_fd() {
+    return fd;
+}
+
+void devread_handle() {
+    char buf[256];
+    ssize_t n;
+
+    if ((n = read(fd, buf, sizeof(buf))) <= 0) {
+        if (n == -1 && (errno == EAGAIN || errno == EINTR))
+            return;
+        l("device closed for reading: %s", n ? strerror(errno) : "hang up");
+        devread_close();
+        return;
+    }
+
+    devread_feed(buf, n);
+}
+
+void devread_feed(const char *buf, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        char c = buf[i];
+        if (c == '\n') {
+            if (line_len && line[line_len - 1] == '\r')
+                --line_len;
+            line[line_len] = '\0';
+            handler(line, line_len);
+            line_len = 0;
+        } else if (line_len < DEVREAD_LINE_MAX) {
+            line[line_len++] = c;
+        }
+    }
+}
@@ -0,0 +1,60 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * devread.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEVREAD_H
+#define DEVREAD_H
+
+/*
+ * Reading of what the board prints, line by line (option read_device).
+ *
+ * The device stays open for reading, in non-canonical mode without echo, so
+ * that the board output is not sent back to it. Output processing is left
+ * untouched, writes behave as before.
+*/
+
+    // Longer lines are cut
+#define DEVREAD_LINE_MAX 512
+    // Lines are identified by one of their fields (options key_field and
+    // field_separators), cut if longer
+#define DEVREAD_KEY_MAX 32
+
+typedef void (*devread_handler_t)(const char *line, size_t len);
+
+    // Returns 0 if the device is open (already or now), -1 otherwise (errno
+    // set)
+int devread_open(const char *dev, devread_handler_t handler);
+void devread_close();
+
+    // -1 if the device is not open
+int devread_fd();
+
+    // Reads what is available and calls the handler for every complete line.
+    // The device gets closed on hang up (unplug...).
+void devread_handle();
+    // Cuts n bytes read from the device in lines, for the handler. Used by
+    // devread_handle(), public for microbench.
+void devread_feed(const char *buf, size_t n);
+
+#endif // DEVREAD_H
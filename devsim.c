@@ -0,0 +1,608 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * devsim.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Device stand-in for mapper-devusb, to exercise the daemon without an Arduino
+ * board plugged.
+ *
+ * Creates a pseudo-terminal, makes LINK a symlink to its slave side (the
+ * daemon is started with LINK as its device file), then feeds the daemon FIFO
+ * with numbered commands at a constant rate while reading back what reaches
+ * the "board".
+ *
+ * A script can inject faults along the run (see devsim-faults.txt). At the end,
+ * a report tells for each fault how long the daemon took to notice it (first
+ * error line in the daemon log), how long it took to resume forwarding once
+ * the device was back, and how many commands got lost or duplicated.
+*/
+
+    // For ppoll()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <termios.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+
+#define FAULT_UNPLUG 0
+#define FAULT_EIO    1
+#define FAULT_STALL  2
+#define FAULT_DROP   3
+#define FAULT_BANNER 4
+
+static const char *fault_names[] = {
+    "unplug", "eio", "stall", "drop", "banner"
+};
+
+#define MAX_FAULTS 64
+#define BANNER_MAX 80
+
+struct fault {
+    int kind;
+    long long at;           // Injection time (usec since start)
+    long arg;               // Duration (ms) or number of bytes
+    char text[BANNER_MAX];  // Banner text
+
+    int started;
+    long long end;          // Time the device got back to normal, -1 if not yet
+    long long detect;       // Latency of the first daemon error, -1 if none
+    long long recover;      // Latency of first command after end, -1 if none
+    unsigned long lost;
+    unsigned long dup;
+};
+
+struct fault faults[MAX_FAULTS];
+int nb_faults = 0;
+
+    // Name of the symlink pointing to the slave side of the pty
+const char *link_name = NULL;
+int master_fd = -1;
+int slave_fd = -1;
+
+int stalled = 0;
+long drop_remaining = 0;
+
+    // Sent commands: seq below nb_sent (sent_at may be 0, at the very start)
+long long *sent_at = NULL;
+unsigned char *recv_count = NULL;
+unsigned long nb_sent = 0;
+unsigned long max_seq = 0;
+
+unsigned long nb_received = 0;
+unsigned long nb_keepalives = 0;
+unsigned long nb_garbage = 0;
+unsigned long nb_backpressure = 0;
+
+long long start_usec;
+
+static long long now_usec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static long long elapsed() {
+    return now_usec() - start_usec;
+}
+
+void usage() {
+    printf("Usage:\n\
+  devsim [OPTIONS] LINK\n\
+Creates a pseudo-terminal reachable through symlink LINK, to be used as\n\
+mapper-devusb device file, and feeds mapper-devusb FIFO with commands.\n\
+\n\
+  -h         Print this help screen\n\
+  -f FIFO    mapper-devusb FIFO to send commands to (mandatory)\n\
+  -s FILE    Fault script\n\
+  -L FILE    mapper-devusb log file, to measure fault detection time\n\
+  -r RATE    Commands per second, default: 50\n\
+  -t MS      Duration of the sending, default: 10000\n\
+  -g MS      Grace period to wait for last commands, default: 2000\n\
+  -n NAME    Name to display in the report\n");
+}
+
+static void die(const char *what) {
+    fprintf(stderr, "devsim: %s: %s\n", what, strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+void read_script(const char *file_name) {
+    FILE *f;
+    if ((f = fopen(file_name, "r")) == NULL)
+        die(file_name);
+
+    char line[256];
+    int line_no = 0;
+    while (fgets(line, sizeof(line), f)) {
+        ++line_no;
+
+        char *p = line;
+        while (*p == ' ' || *p == '\t')
+            ++p;
+        if (*p == '#' || *p == '\n' || *p == '\0')
+            continue;
+
+        if (nb_faults >= MAX_FAULTS) {
+            fprintf(stderr, "%s:%i: error: too many faults (max: %d)\n",
+                    file_name, line_no, MAX_FAULTS);
+            exit(EXIT_FAILURE);
+        }
+
+        struct fault *ft = &faults[nb_faults];
+        long at;
+        char kind[16];
+        int n;
+        if (sscanf(p, "%ld %15s %n", &at, kind, &n) != 2) {
+            fprintf(stderr, "%s:%i: error: syntax error\n", file_name, line_no);
+            exit(EXIT_FAILURE);
+        }
+        p += n;
+
+        ft->kind = -1;
+        for (size_t i = 0; i < sizeof(fault_names) / sizeof(*fault_names);
+                ++i) {
+            if (!strcmp(kind, fault_names[i]))
+                ft->kind = i;
+        }
+        if (ft->kind == -1) {
+            fprintf(stderr, "%s:%i: error: unknown fault '%s'\n",
+                    file_name, line_no, kind);
+            exit(EXIT_FAILURE);
+        }
+
+        if (ft->kind == FAULT_BANNER) {
+            size_t len = strcspn(p, "\r\n");
+            if (len >= sizeof(ft->text))
+                len = sizeof(ft->text) - 1;
+            memcpy(ft->text, p, len);
+            ft->text[len] = '\0';
+        } else if (sscanf(p, "%ld", &ft->arg) != 1 || ft->arg < 0) {
+            fprintf(stderr, "%s:%i: error: %s: missing argument\n",
+                    file_name, line_no, kind);
+            exit(EXIT_FAILURE);
+        }
+
+        ft->at = (long long)at * 1000;
+        ft->end = -1;
+        ft->detect = -1;
+        ft->recover = -1;
+        ++nb_faults;
+    }
+    fclose(f);
+}
+
+    // Opens the slave side of the pty, and keeps it open as a real device stays
+    // present whether the daemon has it open or not.
+void unlock_device() {
+    const char *slave_name = ptsname(master_fd);
+    if (unlockpt(master_fd))
+        die("unlockpt");
+    if ((slave_fd = open(slave_name, O_RDWR | O_NOCTTY)) == -1)
+        die(slave_name);
+
+    struct termios term;
+    if (tcgetattr(slave_fd, &term))
+        die("tcgetattr");
+    cfmakeraw(&term);
+    if (tcsetattr(slave_fd, TCSANOW, &term))
+        die("tcsetattr");
+}
+
+    // Creates the pty and points link_name to its slave side.
+    // When lock is set, the slave is left locked so that opening it fails with
+    // EIO, until unlock_device() is called.
+void plug_device(int lock) {
+    if ((master_fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK)) == -1)
+        die("posix_openpt");
+    if (grantpt(master_fd))
+        die("grantpt");
+
+    unlink(link_name);
+    if (symlink(ptsname(master_fd), link_name))
+        die(link_name);
+
+    if (!lock)
+        unlock_device();
+}
+
+void unplug_device(int keep_link) {
+    if (!keep_link)
+        unlink(link_name);
+    if (slave_fd != -1)
+        close(slave_fd);
+    if (master_fd != -1)
+        close(master_fd);
+    slave_fd = -1;
+    master_fd = -1;
+}
+
+void cleanup() {
+    if (link_name)
+        unlink(link_name);
+}
+
+void on_signal(int sig) {
+    (void)sig;
+    cleanup();
+    _exit(EXIT_FAILURE);
+}
+
+    // Latest fault still waiting for a daemon reaction
+void on_daemon_error(long long t) {
+    for (int i = nb_faults - 1; i >= 0; --i) {
+        if (faults[i].started) {
+            if (faults[i].detect == -1)
+                faults[i].detect = t - faults[i].at;
+            return;
+        }
+    }
+}
+
+void on_command(unsigned long seq, long long t) {
+    if (seq >= nb_sent) {
+        ++nb_garbage;
+        return;
+    }
+    if (recv_count[seq] < 255)
+        ++recv_count[seq];
+    ++nb_received;
+
+    for (int i = 0; i < nb_faults; ++i) {
+        if (faults[i].end != -1 && faults[i].recover == -1
+                && t >= faults[i].end)
+            faults[i].recover = t - faults[i].end;
+    }
+}
+
+void on_device_line(char *line, long long t) {
+    size_t len = strlen(line);
+    if (len >= 1 && line[len - 1] == '\r')
+        line[--len] = '\0';
+    if (!len)
+        return;
+
+    unsigned long seq;
+    char c;
+    if (!strcmp(line, "noop")) {
+        ++nb_keepalives;
+    } else if (sscanf(line, "bench %lu%c", &seq, &c) == 1) {
+        on_command(seq, t);
+    } else {
+        ++nb_garbage;
+    }
+}
+
+void read_device() {
+    static char acc[512];
+    static size_t acc_len = 0;
+
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(master_fd, buf, sizeof(buf))) > 0) {
+        long long t = elapsed();
+        for (ssize_t i = 0; i < n; ++i) {
+            if (drop_remaining > 0) {
+                --drop_remaining;
+                continue;
+            }
+            if (buf[i] == '\n') {
+                acc[acc_len] = '\0';
+                on_device_line(acc, t);
+                acc_len = 0;
+            } else if (acc_len < sizeof(acc) - 1) {
+                acc[acc_len++] = buf[i];
+            }
+        }
+    }
+}
+
+void watch_log(int log_fd) {
+    static char acc[1024];
+    static size_t acc_len = 0;
+
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(log_fd, buf, sizeof(buf))) > 0) {
+        long long t = elapsed();
+        for (ssize_t i = 0; i < n; ++i) {
+            if (buf[i] == '\n') {
+                acc[acc_len] = '\0';
+                if (strstr(acc, "error"))
+                    on_daemon_error(t);
+                acc_len = 0;
+            } else if (acc_len < sizeof(acc) - 1) {
+                acc[acc_len++] = buf[i];
+            }
+        }
+    }
+}
+
+void start_fault(struct fault *ft) {
+    ft->started = 1;
+    switch (ft->kind) {
+    case FAULT_UNPLUG:
+        unplug_device(0);
+        break;
+    case FAULT_EIO:
+            // Hang up whoever has the device open, and have new opens fail
+            // with EIO.
+        unplug_device(1);
+        plug_device(1);
+        break;
+    case FAULT_STALL:
+        stalled = 1;
+        break;
+    case FAULT_DROP:
+        drop_remaining = ft->arg;
+        ft->end = ft->at;
+        break;
+    case FAULT_BANNER:
+        if (master_fd != -1) {
+            char buf[BANNER_MAX + 2];
+            int n = snprintf(buf, sizeof(buf), "%s\r\n", ft->text);
+            if (write(master_fd, buf, n) != n) {
+                    // Nobody reads the board output, fine.
+            }
+        }
+        ft->end = ft->at;
+        break;
+    }
+}
+
+void end_fault(struct fault *ft, long long t) {
+    switch (ft->kind) {
+    case FAULT_UNPLUG:
+        plug_device(0);
+        break;
+    case FAULT_EIO:
+        unlock_device();
+        break;
+    case FAULT_STALL:
+        stalled = 0;
+        break;
+    }
+    ft->end = t;
+}
+
+void send_command(int fifo_fd) {
+    if (nb_sent >= max_seq)
+        return;
+
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "bench %06lu\n", nb_sent);
+    ssize_t w = write(fifo_fd, buf, n);
+    if (w == n) {
+        sent_at[nb_sent] = elapsed();
+        ++nb_sent;
+    } else if (w == -1 && errno == EAGAIN) {
+        ++nb_backpressure;
+    } else {
+        die("write to fifo");
+    }
+}
+
+static double ms(long long usec) {
+    return usec / 1000.0;
+}
+
+void report(const char *name) {
+    unsigned long lost = 0;
+    unsigned long dup = 0;
+    for (unsigned long seq = 0; seq < nb_sent; ++seq) {
+        if (recv_count[seq] == 1)
+            continue;
+
+            // Blame the fault whose window covers the sending
+        struct fault *blame = NULL;
+        for (int i = 0; i < nb_faults; ++i) {
+            struct fault *ft = &faults[i];
+            long long until = (ft->end == -1 ? sent_at[seq] : ft->end);
+            if (ft->recover != -1)
+                until += ft->recover;
+            if (ft->started && sent_at[seq] >= ft->at && sent_at[seq] <= until)
+                blame = ft;
+        }
+
+        if (!recv_count[seq]) {
+            ++lost;
+            if (blame)
+                ++blame->lost;
+        } else {
+            dup += recv_count[seq] - 1;
+            if (blame)
+                blame->dup += recv_count[seq] - 1;
+        }
+    }
+
+    printf("config: %s\n", name ? name : "-");
+    printf("%-8s %9s %9s %10s %11s %6s %5s\n", "fault", "at_ms", "arg",
+           "detect_ms", "recover_ms", "lost", "dup");
+    for (int i = 0; i < nb_faults; ++i) {
+        struct fault *ft = &faults[i];
+        char detect[16];
+        char recover[16];
+        if (ft->detect == -1)
+            strcpy(detect, "-");
+        else
+            snprintf(detect, sizeof(detect), "%.1f", ms(ft->detect));
+        if (ft->recover == -1)
+            strcpy(recover, "-");
+        else
+            snprintf(recover, sizeof(recover), "%.1f", ms(ft->recover));
+        printf("%-8s %9.0f %9ld %10s %11s %6lu %5lu\n",
+               fault_names[ft->kind], ms(ft->at), ft->arg, detect, recover,
+               ft->lost, ft->dup);
+    }
+    printf("total: sent %lu, received %lu, lost %lu, duplicated %lu, "
+           "keepalives %lu, garbage %lu, fifo full %lu\n",
+           nb_sent, nb_received, lost, dup, nb_keepalives, nb_garbage,
+           nb_backpressure);
+}
+
+int main(int argc, char *argv[]) {
+    const char *fifo_name = NULL;
+    const char *script_name = NULL;
+    const char *log_name = NULL;
+    const char *name = NULL;
+    long rate = 50;
+    long duration_ms = 10000;
+    long grace_ms = 2000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hf:s:L:r:t:g:n:")) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            exit(0);
+        case 'f':
+            fifo_name = optarg;
+            break;
+        case 's':
+            script_name = optarg;
+            break;
+        case 'L':
+            log_name = optarg;
+            break;
+        case 'r':
+            rate = atol(optarg);
+            break;
+        case 't':
+            duration_ms = atol(optarg);
+            break;
+        case 'g':
+            grace_ms = atol(optarg);
+            break;
+        case 'n':
+            name = optarg;
+            break;
+        default:
+            fprintf(stderr, "Try `devsim -h' for more information.\n");
+            exit(1);
+        }
+    }
+    if (optind != argc - 1 || !fifo_name || rate <= 0 || duration_ms <= 0) {
+        fprintf(stderr, "Try `devsim -h' for more information.\n");
+        exit(1);
+    }
+    link_name = argv[optind];
+
+    if (script_name)
+        read_script(script_name);
+
+    max_seq = rate * duration_ms / 1000 + 1;
+    sent_at = calloc(max_seq, sizeof(*sent_at));
+    recv_count = calloc(max_seq, sizeof(*recv_count));
+    if (!sent_at || !recv_count)
+        die("calloc");
+
+    atexit(cleanup);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    plug_device(0);
+
+    int log_fd = -1;
+    if (log_name) {
+        if ((log_fd = open(log_name, O_RDONLY | O_NONBLOCK)) == -1)
+            die(log_name);
+        lseek(log_fd, 0, SEEK_END);
+    }
+
+        // The daemon may still be starting: wait for it to open its FIFO.
+    int fifo_fd = -1;
+    for (int i = 0; i < 500 && fifo_fd == -1; ++i) {
+        if ((fifo_fd = open(fifo_name, O_WRONLY | O_NONBLOCK)) == -1) {
+            if (errno != ENXIO && errno != ENOENT)
+                die(fifo_name);
+            usleep(10000);
+        }
+    }
+    if (fifo_fd == -1)
+        die(fifo_name);
+
+    start_usec = now_usec();
+    long long duration = (long long)duration_ms * 1000;
+    long long period = 1000000 / rate;
+    long long next_send = 0;
+
+    long long t;
+    while ((t = elapsed()) < duration + (long long)grace_ms * 1000) {
+        for (int i = 0; i < nb_faults; ++i) {
+            struct fault *ft = &faults[i];
+            if (!ft->started && t >= ft->at) {
+                start_fault(ft);
+            } else if (ft->started && ft->end == -1
+                    && t >= ft->at + ft->arg * 1000) {
+                end_fault(ft, t);
+            }
+        }
+
+        if (t < duration && t >= next_send) {
+            send_command(fifo_fd);
+            next_send += period;
+        }
+
+        long long wait = (t < duration ? next_send - t : 5000);
+        if (wait > 5000)
+            wait = 5000;
+        if (wait < 0)
+            wait = 0;
+
+            // In usec: in msec, rates above 1000/s would spin
+        struct timespec ts;
+        ts.tv_sec = wait / 1000000;
+        ts.tv_nsec = (wait % 1000000) * 1000;
+        struct pollfd pfd;
+        pfd.fd = master_fd;
+        pfd.events = POLLIN;
+        if (master_fd != -1 && slave_fd != -1 && !stalled) {
+            if (ppoll(&pfd, 1, &ts, NULL) > 0)
+                read_device();
+        } else {
+            ppoll(NULL, 0, &ts, NULL);
+        }
+
+        if (log_fd != -1)
+            watch_log(log_fd);
+    }
+
+    report(name);
+
+    close(fifo_fd);
+    if (log_fd != -1)
+        close(log_fd);
+    unplug_device(0);
+    free(sent_at);
+    free(recv_count);
+
+    return 0;
+}
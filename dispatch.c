@@ -0,0 +1,207 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * dispatch.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "util.h"
+#include "metrics.h"
+#include "dedup.h"
+#include "dispatch.h"
+
+#define NONE -1
+
+struct node {
+    unsigned long id;           // 0 if the slot is free
+    size_t len;
+    uint64_t key;               // Hash of the idempotency key, 0 if none
+    int source;                 // NONE if in no list
+    int cancelled;
+    int prev;                   // In the list of the source
+    int next;
+};
+
+struct source {
+    char name[CLIENT_FIFO_NAME_MAX + 1];
+    int first;
+    int last;
+};
+
+struct dispatch_stats dispatch_stats;
+
+static struct node nodes[DISPATCH_INDEX_SIZE];
+static struct source sources[DISPATCH_SOURCES];
+static unsigned long head_id;   // Of the message at the head of the queue
+static unsigned long next_id;
+static unsigned long queued_cancelled;
+
+static void reset() {
+    for (int i = 0; i < DISPATCH_INDEX_SIZE; ++i)
+        nodes[i].id = 0;
+    for (int i = 0; i < DISPATCH_SOURCES; ++i) {
+        sources[i].name[0] = '\0';
+        sources[i].first = NONE;
+        sources[i].last = NONE;
+    }
+    queued_cancelled = 0;
+}
+
+void dispatch_init(unsigned long queued) {
+    reset();
+    head_id = 1;
+    next_id = 1 + queued;
+}
+
+static void unlink_node(int n) {
+    struct node *nd = &nodes[n];
+    if (nd->source == NONE)
+        return;
+    struct source *src = &sources[nd->source];
+    if (nd->prev == NONE)
+        src->first = nd->next;
+    else
+        nodes[nd->prev].next = nd->next;
+    if (nd->next == NONE)
+        src->last = nd->prev;
+    else
+        nodes[nd->next].prev = nd->prev;
+    nd->source = NONE;
+}
+
+    // The messages of the previous owner of the source can no longer be
+    // cancelled through it
+static void rename_source(int source, const char *name) {
+    struct source *src = &sources[source];
+    for (int n = src->first; n != NONE; n = nodes[n].next)
+        nodes[n].source = NONE;
+    src->first = NONE;
+    src->last = NONE;
+    s_strncpy(src->name, name, sizeof(src->name));
+}
+
+unsigned long dispatch_pushed(int source, const char *name, size_t len,
+                             uint64_t key) {
+    unsigned long id = next_id++;
+    int n = id % DISPATCH_INDEX_SIZE;
+    struct node *nd = &nodes[n];
+        // An older message, still queued, leaves the index. Unless it got
+        // cancelled: the new one is not indexed then.
+    if (nd->id && nd->cancelled)
+        return id;
+    if (nd->id)
+        unlink_node(n);
+
+    if (strcmp(sources[source].name, name))
+        rename_source(source, name);
+    struct source *src = &sources[source];
+    nd->id = id;
+    nd->len = len;
+    nd->key = key;
+    nd->source = source;
+    nd->cancelled = 0;
+    nd->prev = src->last;
+    nd->next = NONE;
+    if (src->last == NONE)
+        src->first = n;
+    else
+        nodes[src->last].next = n;
+    src->last = n;
+    return id;
+}
+
+int dispatch_cancelled(unsigned long id) {
+    const struct node *nd = &nodes[id % DISPATCH_INDEX_SIZE];
+    return nd->id == id && nd->cancelled;
+}
+
+void dispatch_popped() {
+    int n = head_id % DISPATCH_INDEX_SIZE;
+    if (nodes[n].id == head_id) {
+        if (nodes[n].cancelled)
+            --queued_cancelled;
+        unlink_node(n);
+        nodes[n].id = 0;
+    }
+    ++head_id;
+}
+
+void dispatch_cleared() {
+    reset();
+    head_id = next_id;
+}
+
+unsigned long dispatch_head_id() {
+    return head_id;
+}
+
+unsigned long dispatch_queued_cancelled() {
+    return queued_cancelled;
+}
+
+    // Its key is forgotten: the message can be sent again
+static void cancel(int n) {
+    unlink_node(n);
+    nodes[n].cancelled = 1;
+    ++queued_cancelled;
+    if (nodes[n].key)
+        dedup_forget(nodes[n].key);
+    ++dispatch_stats.cancelled;
+    dispatch_stats.cancelled_bytes += nodes[n].len;
+}
+
+int dispatch_cancel(unsigned long id) {
+    int n = id % DISPATCH_INDEX_SIZE;
+    if (id < head_id || id >= next_id || nodes[n].id != id
+            || nodes[n].cancelled)
+        return -1;
+    cancel(n);
+    return 0;
+}
+
+unsigned long dispatch_cancel_source(int source, const char *name) {
+    if (strcmp(sources[source].name, name))
+        return 0;
+    unsigned long nb = 0;
+    while (sources[source].first != NONE) {
+        cancel(sources[source].first);
+        ++nb;
+    }
+    return nb;
+}
+
+void dispatch_write_metrics() {
+    if (!dispatch_stats.cancelled)
+        return;
+
+    metrics_printf("# HELP mapper_devusb_cancelled_total Queued messages "
+                   "cancelled\n");
+    metrics_printf("# TYPE mapper_devusb_cancelled_total counter\n");
+    metrics_printf("mapper_devusb_cancelled_total %lu\n",
+                   dispatch_stats.cancelled);
+    metrics_printf("# HELP mapper_devusb_cancelled_bytes_total Bytes of the "
+                   "queued messages cancelled\n");
+    metrics_printf("# TYPE mapper_devusb_cancelled_bytes_total counter\n");
+    metrics_printf("mapper_devusb_cancelled_bytes_total %llu\n",
+                   dispatch_stats.cancelled_bytes);
+}
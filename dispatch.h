@@ -0,0 +1,91 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * dispatch.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "client_fifo.h"
+#include "vpty.h"
+
+/*
+ * Ids of the queued messages, for control command cancel.
+ *
+ * Messages get consecutive ids as they enter the queue (see queue.h), so the
+ * id of the message at the head tells the ids of all others. The last
+ * DISPATCH_INDEX_SIZE ones are indexed by id modulo that size, and linked in
+ * a list per source (main FIFO, control socket, client FIFO, pty): cancelling a
+ * message is O(1), cancelling those of a source costs their number. A
+ * cancelled message stays in the queue and is skipped when its turn comes, or
+ * when the queue is saved at termination.
+ *
+ * Ids start from 1 at every start, messages queued by a previous run cannot
+ * be cancelled.
+*/
+
+#define DISPATCH_INDEX_SIZE 4096
+
+#define DISPATCH_SOURCE_MAIN    0
+#define DISPATCH_SOURCE_CONTROL 1
+    // i being the index of the FIFO in client_fifos
+#define DISPATCH_SOURCE_FIFO(i) (2 + (i))
+    // i being the index of the pty in vptys
+#define DISPATCH_SOURCE_PTY(i)  (DISPATCH_SOURCE_FIFO(MAX_CLIENT_FIFOS) + (i))
+#define DISPATCH_SOURCES        DISPATCH_SOURCE_PTY(MAX_VPTYS)
+
+struct dispatch_stats {
+    unsigned long cancelled;
+    unsigned long long cancelled_bytes;
+};
+
+extern struct dispatch_stats dispatch_stats;
+
+    // queued messages are in the queue already
+void dispatch_init(unsigned long queued);
+
+    // A message of len bytes from source (named name) entered the queue.
+    // key: hash of its idempotency key (see dedup.h), 0 if none.
+    // Returns its id.
+unsigned long dispatch_pushed(int source, const char *name, size_t len,
+                             uint64_t key);
+int dispatch_cancelled(unsigned long id);
+    // The message at the head of the queue left it
+void dispatch_popped();
+    // The queue got emptied
+void dispatch_cleared();
+unsigned long dispatch_head_id();
+    // Number of the messages still queued that got cancelled
+unsigned long dispatch_queued_cancelled();
+
+    // Returns 0 on success, -1 if id is not queued or no longer indexed
+int dispatch_cancel(unsigned long id);
+    // Returns the number of messages cancelled
+unsigned long dispatch_cancel_source(int source, const char *name);
+
+void dispatch_write_metrics();
+
+#endif // DISPATCH_H
@@ -0,0 +1,52 @@
+#!/bin/sh
+
+#
+# Copyright 2026 Sébastien Millet
+#
+
+# Runs mapper-devusb against devsim (a pty standing in for the Arduino board),
+# once per configuration file, and prints for each one devsim report: fault
+# detection and recovery times, lost and duplicated commands.
+#
+# Usage:
+#   ./fault-bench.sh [-s FAULT_SCRIPT] [CONFIG_FILE...]
+#
+# To be run from the build directory. The FIFO, device and log file of the
+# configuration files are overridden. Without configuration file, runs once with
+# default settings.
+
+set -eu
+
+SCRIPT=$(dirname "$0")/devsim-faults.txt
+if [ "${1:-}" = "-s" ]; then
+    SCRIPT="$2"
+    shift 2
+fi
+
+RATE=${RATE:-50}
+DURATION=${DURATION:-10000}
+
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+if [ $# -eq 0 ]; then
+    echo "log_usec = yes" > "$WORKDIR/default.conf"
+    set -- "$WORKDIR/default.conf"
+fi
+
+for conf in "$@"; do
+    rm -f "$WORKDIR/fifo" "$WORKDIR/log"
+    mkfifo "$WORKDIR/fifo"
+    : > "$WORKDIR/log"
+
+    ./mapper-devusb -c "$conf" -f "$WORKDIR/fifo" -l "$WORKDIR/log" \
+        "$WORKDIR/tty" &
+    pid=$!
+
+    ./devsim -f "$WORKDIR/fifo" -s "$SCRIPT" -L "$WORKDIR/log" \
+        -r "$RATE" -t "$DURATION" -n "$conf" "$WORKDIR/tty"
+    echo
+
+    echo "EOF()" > "$WORKDIR/fifo"
+    wait $pid || true
+done
@@ -0,0 +1,234 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * mapper-devusb-series.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Displays the time series mapper-devusb keeps in its chunk files (see option
+ * series_dir), optionally for a key and a time range, without talking to the
+ * daemon.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "series.h"
+
+#define VERSION "1.0"
+
+static const char *key_filter = NULL;
+static uint64_t from = 0;           // Epoch msec
+static uint64_t to = UINT64_MAX;    // Excluded
+static int epoch_output = 0;
+
+void usage() {
+    printf("Usage:\n\
+  mapper-devusb-series [OPTIONS] [FILE...]\n\
+Displays the samples of mapper-devusb time series FILEs, by default all of\n\
+DIR/*" SERIES_SUFFIX ", one per line: date, device, key and value.\n\
+\n\
+  -h       Print this help screen\n\
+  -v       Print version information and quit\n\
+  -d DIR   Directory of the chunk files, default: " SERIES_DEFAULT_DIR "\n\
+  -k KEY   Display only samples of KEY\n\
+  -f TIME  Display only samples taken at or after TIME\n\
+  -t TIME  Display only samples taken before TIME\n\
+  -e       Print dates as epoch milliseconds\n\
+TIME is YYYY-MM-DD [HH:MM[:SS]] (local time), or epoch seconds.\n");
+}
+
+    // Returns epoch msec, exits if time cannot be parsed
+static uint64_t parse_time(const char *s) {
+    char *end;
+    long long epoch = strtoll(s, &end, 10);
+    if (*s && *end == '\0')
+        return epoch * 1000;
+
+    static const char *const formats[] = {
+        "%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d"
+    };
+    for (size_t i = 0; i < sizeof(formats) / sizeof(*formats); ++i) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char *p = strptime(s, formats[i], &tm);
+        if (p && *p == '\0') {
+            tm.tm_isdst = -1;
+            return (uint64_t)mktime(&tm) * 1000;
+        }
+    }
+    fprintf(stderr, "%s: unknown time format\n", s);
+    exit(1);
+}
+
+static void print_time(uint64_t t) {
+    if (epoch_output) {
+        printf("%llu", (unsigned long long)t);
+        return;
+    }
+    char buf[32];
+    time_t sec = t / 1000;
+    struct tm ts;
+    localtime_r(&sec, &ts);
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &ts);
+    printf("%s.%03u", buf, (unsigned)(t % 1000));
+}
+
+static int show(const char *file_name) {
+    int fd;
+    if ((fd = open(file_name, O_RDONLY)) == -1) {
+        fprintf(stderr, "%s: %s\n", file_name, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        fprintf(stderr, "%s: %s\n", file_name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (st.st_size < (off_t)sizeof(struct series_header)) {
+        fprintf(stderr, "%s: not a mapper-devusb series file\n", file_name);
+        close(fd);
+        return -1;
+    }
+    const void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", file_name, strerror(errno));
+        return -1;
+    }
+
+    struct series_reader r;
+    if (series_reader_init(&r, mapped, st.st_size)) {
+        fprintf(stderr, "%s: not a mapper-devusb series file, or unknown "
+                "version\n", file_name);
+        munmap((void *)mapped, st.st_size);
+        return -1;
+    }
+
+    char device[sizeof(r.header->device)];
+    memcpy(device, r.header->device, sizeof(device));
+    device[sizeof(device) - 1] = '\0';
+
+    int key;
+    uint64_t t;
+    double value;
+    if (r.header->start < to) {
+        while (!series_next(&r, &key, &t, &value)) {
+            const char *k = r.header->keys[key];
+            if (t < from || t >= to || (key_filter && strcmp(k, key_filter)))
+                continue;
+            print_time(t);
+            printf(" %s %.*s %.15g\n", device, SERIES_KEY_MAX, k, value);
+        }
+    }
+    int status = 0;
+    if (r.pos > r.bits) {
+        fprintf(stderr, "%s: damaged after %llu bits\n", file_name,
+                (unsigned long long)r.pos);
+        status = -1;
+    }
+    munmap((void *)mapped, st.st_size);
+    return status;
+}
+
+static int is_chunk(const struct dirent *ent) {
+    size_t len = strlen(ent->d_name);
+    size_t suffix_len = strlen(SERIES_SUFFIX);
+    return len > suffix_len
+           && !strcmp(ent->d_name + len - suffix_len, SERIES_SUFFIX);
+}
+
+int main(int argc, char *argv[]) {
+    const char *dir = SERIES_DEFAULT_DIR;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hvd:k:f:t:e")) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            exit(0);
+        case 'v':
+            printf("mapper-devusb-series version " VERSION "\n");
+            exit(0);
+        case 'd':
+            dir = optarg;
+            break;
+        case 'k':
+            key_filter = optarg;
+            break;
+        case 'f':
+            from = parse_time(optarg);
+            break;
+        case 't':
+            to = parse_time(optarg);
+            break;
+        case 'e':
+            epoch_output = 1;
+            break;
+        default:
+            fprintf(stderr, "Try `mapper-devusb-series -h' for more "
+                    "information.\n");
+            exit(1);
+        }
+    }
+
+    int status = 0;
+    if (optind < argc) {
+        for (int i = optind; i < argc; ++i) {
+            if (show(argv[i]))
+                status = 1;
+        }
+        return status;
+    }
+
+        // Names end with the start time: chunks of a device come in order
+    struct dirent **ents;
+    int nb;
+    if ((nb = scandir(dir, &ents, is_chunk, alphasort)) == -1) {
+        fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    for (int i = 0; i < nb; ++i) {
+        char file_name[PATH_MAX];
+        snprintf(file_name, sizeof(file_name), "%s/%s", dir, ents[i]->d_name);
+        if (show(file_name))
+            status = 1;
+        free(ents[i]);
+    }
+    free(ents);
+    if (!nb)
+        fprintf(stderr, "%s: no series file\n", dir);
+
+    return status;
+}
@@ -0,0 +1,199 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * mapper-devusb-stat.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Displays the statistics mapper-devusb keeps in its stats files (see option
+ * stats_dir), without talking to the daemon.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "stats.h"
+
+#define VERSION "1.1"
+
+void usage() {
+    printf("Usage:\n\
+  mapper-devusb-stat [OPTIONS] [FILE...]\n\
+Displays statistics of mapper-devusb stats FILEs, by default all of\n\
+" STATS_DEFAULT_DIR "/*" STATS_SUFFIX "\n\
+\n\
+  -h       Print this help screen\n\
+  -v       Print version information and quit\n");
+}
+
+static void print_date(const char *label, uint64_t epoch) {
+    char buf[32];
+    time_t t = epoch;
+    struct tm ts;
+    localtime_r(&t, &ts);
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &ts);
+    printf("  %-16s %s\n", label, buf);
+}
+
+static void print_histogram(const char *label, const uint64_t *buckets,
+        int nb_buckets, const char *unit) {
+    uint64_t total = 0;
+    for (int i = 0; i < nb_buckets; ++i)
+        total += buckets[i];
+    printf("  %s (%s):%s\n", label, unit, total ? "" : " -");
+    if (!total)
+        return;
+
+    for (int i = 0; i < nb_buckets; ++i) {
+        if (!buckets[i])
+            continue;
+        unsigned long long lo = (i ? 1ULL << i : 0);
+        if (i == nb_buckets - 1)
+            printf("    %10llu and more  ", lo);
+        else
+            printf("    %10llu .. %-7llu", lo, (1ULL << (i + 1)) - 1);
+        printf(" %12llu  %5.1f%%\n", (unsigned long long)buckets[i],
+               buckets[i] * 100.0 / total);
+    }
+}
+
+static int show(const char *file_name) {
+    int fd;
+    if ((fd = open(file_name, O_RDONLY)) == -1) {
+        fprintf(stderr, "%s: %s\n", file_name, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < (off_t)sizeof(struct stats_file)) {
+        fprintf(stderr, "%s: not a mapper-devusb stats file\n", file_name);
+        close(fd);
+        return -1;
+    }
+    const struct stats_file *mapped = mmap(NULL, sizeof(*mapped), PROT_READ,
+                                           MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", file_name, strerror(errno));
+        return -1;
+    }
+
+    struct stats_file s;
+    int r = stats_snapshot(mapped, &s);
+    munmap((void *)mapped, sizeof(*mapped));
+    if (r) {
+        fprintf(stderr, "%s: update in progress never ended\n", file_name);
+        return -1;
+    }
+    if (s.magic != STATS_MAGIC || s.version != STATS_VERSION
+            || s.size != sizeof(s)) {
+        fprintf(stderr, "%s: not a mapper-devusb stats file, or unknown "
+                "version\n", file_name);
+        return -1;
+    }
+
+    s.device[sizeof(s.device) - 1] = '\0';
+    printf("%s\n", file_name);
+    printf("  %-16s %s\n", "device", s.device);
+    print_date("created", s.created);
+    print_date("updated", s.updated);
+    printf("  %-16s %llu\n", "starts", (unsigned long long)s.starts);
+    printf("  %-16s %llu\n", "messages", (unsigned long long)s.messages);
+    printf("  %-16s %llu\n", "bytes received",
+           (unsigned long long)s.bytes_received);
+    printf("  %-16s %llu\n", "bytes written",
+           (unsigned long long)s.bytes_written);
+    printf("  %-16s %llu\n", "writes", (unsigned long long)s.writes);
+    printf("  %-16s %llu\n", "write errors",
+           (unsigned long long)s.write_errors);
+    printf("  %-16s %llu\n", "keepalives", (unsigned long long)s.keepalives);
+    printf("  %-16s %llu\n", "reconnects", (unsigned long long)s.reconnects);
+    printf("  %-16s %.1f s\n", "downtime", s.downtime_usec / 1e6);
+    printf("  %-16s %llu\n", "dropped", (unsigned long long)s.dropped);
+    print_histogram("write latency", s.write_latency, STATS_LATENCY_BUCKETS,
+                    "usec");
+    print_histogram("message size", s.message_size, STATS_SIZE_BUCKETS,
+                    "bytes");
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "hv")) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            exit(0);
+        case 'v':
+            printf("mapper-devusb-stat version " VERSION "\n");
+            exit(0);
+        default:
+            fprintf(stderr, "Try `mapper-devusb-stat -h' for more "
+                    "information.\n");
+            exit(1);
+        }
+    }
+
+    int status = 0;
+    if (optind < argc) {
+        for (int i = optind; i < argc; ++i) {
+            if (show(argv[i]))
+                status = 1;
+        }
+        return status;
+    }
+
+    DIR *dir;
+    if ((dir = opendir(STATS_DEFAULT_DIR)) == NULL) {
+        fprintf(stderr, "%s: %s\n", STATS_DEFAULT_DIR, strerror(errno));
+        return 1;
+    }
+    struct dirent *ent;
+    int nb = 0;
+    while ((ent = readdir(dir)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        size_t suffix_len = strlen(STATS_SUFFIX);
+        if (len <= suffix_len
+                || strcmp(ent->d_name + len - suffix_len, STATS_SUFFIX))
+            continue;
+        char file_name[PATH_MAX];
+        snprintf(file_name, sizeof(file_name), "%s/%s", STATS_DEFAULT_DIR,
+                 ent->d_name);
+        if (nb++)
+            printf("\n");
+        if (show(file_name))
+            status = 1;
+    }
+    closedir(dir);
+    if (!nb)
+        fprintf(stderr, "%s: no stats file\n", STATS_DEFAULT_DIR);
+
+    return status;
+}
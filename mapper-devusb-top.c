@@ -0,0 +1,432 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * mapper-devusb-top.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * Live view of the mapper-devusb daemons that keep a stats file (see option
+ * stats_dir), one line per device, refreshed several times per second.
+ *
+ * It only reads the memory-mapped stats files: the daemons do not know they
+ * are watched. Rates and latency percentiles are computed over the last
+ * window seconds, from the difference between the counters and histograms
+ * now and at the start of the window.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <termios.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#include <linux/limits.h>
+
+#include "stats.h"
+
+#define VERSION "1.0"
+
+#define DEFAULT_INTERVAL 250        // ms
+#define DEFAULT_WINDOW   5          // s
+#define MAX_DEVICES      64
+#define MAX_SNAPSHOTS    64         // Per device, over the window
+
+struct device {
+    char file_name[PATH_MAX];
+    const struct stats_file *mapped;
+        // Ring of the snapshots of the window, oldest at tail
+    struct stats_file snapshots[MAX_SNAPSHOTS];
+    long long taken_at[MAX_SNAPSHOTS];  // msec
+    int head;
+    int nb;
+};
+
+static struct device *devices;
+static int nb_devices = 0;
+static const char *dir = STATS_DEFAULT_DIR;
+static int scan_dir = 1;
+static long interval = DEFAULT_INTERVAL;
+static long window = DEFAULT_WINDOW;
+static int nb_snapshots;            // Kept per device, to cover the window
+static long sample;                 // ms between snapshots kept
+
+static struct termios saved_term;
+static int term_saved = 0;
+static volatile sig_atomic_t quit = 0;
+
+void usage() {
+    printf("Usage:\n\
+  mapper-devusb-top [OPTIONS] [FILE...]\n\
+Displays live the state of the mapper-devusb daemons of stats FILEs, by\n\
+default all of DIR/*" STATS_SUFFIX ". Press q to quit.\n\
+\n\
+  -h       Print this help screen\n\
+  -v       Print version information and quit\n\
+  -d DIR   Directory of the stats files, default: " STATS_DEFAULT_DIR "\n\
+  -i MS    Refresh every MS milliseconds, default: %d\n\
+  -w S     Rates and percentiles over the last S seconds, default: %d\n\
+  -n N     Quit after N refreshes\n", DEFAULT_INTERVAL, DEFAULT_WINDOW);
+}
+
+static long long now_msec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void add_device(const char *file_name) {
+    for (int i = 0; i < nb_devices; ++i) {
+        if (!strcmp(devices[i].file_name, file_name))
+            return;
+    }
+    if (nb_devices == MAX_DEVICES)
+        return;
+
+    int fd;
+    if ((fd = open(file_name, O_RDONLY)) == -1)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < (off_t)sizeof(struct stats_file)) {
+        close(fd);
+        return;
+    }
+    const struct stats_file *mapped = mmap(NULL, sizeof(*mapped), PROT_READ,
+                                           MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return;
+    if (mapped->magic != STATS_MAGIC || mapped->version != STATS_VERSION
+            || mapped->size != sizeof(*mapped)) {
+        munmap((void *)mapped, sizeof(*mapped));
+        return;
+    }
+
+    struct device *d = &devices[nb_devices++];
+    snprintf(d->file_name, sizeof(d->file_name), "%s", file_name);
+    d->mapped = mapped;
+    d->head = 0;
+    d->nb = 0;
+}
+
+    // Daemons started meanwhile show up
+static void scan() {
+    DIR *dp;
+    if ((dp = opendir(dir)) == NULL)
+        return;
+    struct dirent *ent;
+    while ((ent = readdir(dp)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        size_t suffix_len = strlen(STATS_SUFFIX);
+        if (len <= suffix_len
+                || strcmp(ent->d_name + len - suffix_len, STATS_SUFFIX))
+            continue;
+        char file_name[PATH_MAX];
+        snprintf(file_name, sizeof(file_name), "%s/%s", dir, ent->d_name);
+        add_device(file_name);
+    }
+    closedir(dp);
+}
+
+    // The newest snapshot gets replaced until it is sample ms after the one
+    // before it: with a window longer than MAX_SNAPSHOTS refreshes, the ring
+    // still covers it
+static void take_snapshot(struct device *d, long long now) {
+    int last = (d->head + nb_snapshots - 1) % nb_snapshots;
+    int prev = (d->head + nb_snapshots - 2) % nb_snapshots;
+    if (d->nb >= 2 && d->taken_at[last] - d->taken_at[prev]
+                      < sample - interval / 2) {
+        if (!stats_snapshot(d->mapped, &d->snapshots[last]))
+            d->taken_at[last] = now;
+        return;
+    }
+    if (stats_snapshot(d->mapped, &d->snapshots[d->head]))
+        return;
+    d->taken_at[d->head] = now;
+    d->head = (d->head + 1) % nb_snapshots;
+    if (d->nb < nb_snapshots)
+        ++d->nb;
+}
+
+    // Value under which a fraction p of the deltas between histograms before
+    // and after are, interpolated within its bucket. -1 if no delta.
+static double percentile(const uint64_t *after, const uint64_t *before,
+                         int nb_buckets, double p) {
+    uint64_t total = 0;
+    for (int i = 0; i < nb_buckets; ++i)
+        total += after[i] - before[i];
+    if (!total)
+        return -1;
+
+    double target = p * total;
+    uint64_t cumul = 0;
+    for (int i = 0; i < nb_buckets; ++i) {
+        uint64_t n = after[i] - before[i];
+        if (n && cumul + n >= target) {
+            double lo = (i ? 1ULL << i : 0);
+            double hi = 1ULL << (i + 1);
+            return lo + (hi - lo) * (target - cumul) / n;
+        }
+        cumul += n;
+    }
+    return 1ULL << nb_buckets;
+}
+
+static const char *format_usec(char *buf, size_t size, double usec) {
+    if (usec < 0)
+        snprintf(buf, size, "-");
+    else if (usec < 1000)
+        snprintf(buf, size, "%.0fus", usec);
+    else if (usec < 1000000)
+        snprintf(buf, size, "%.1fms", usec / 1000);
+    else
+        snprintf(buf, size, "%.1fs", usec / 1000000);
+    return buf;
+}
+
+static void show_device(const struct device *d, time_t wall) {
+    const struct stats_file *s =
+        &d->snapshots[(d->head + nb_snapshots - 1) % nb_snapshots];
+    int tail = (d->head + nb_snapshots - d->nb) % nb_snapshots;
+    const struct stats_file *old = &d->snapshots[tail];
+    long long msec = d->taken_at[(d->head + nb_snapshots - 1) % nb_snapshots]
+                     - d->taken_at[tail];
+        // Counters reset by a restart with another format: start over
+    double secs = (msec > 0 && s->starts == old->starts ? msec / 1000.0 : 0);
+
+    const char *base = strrchr(s->device, '/');
+    base = (base ? base + 1 : s->device);
+
+    char state[32];
+    if (!s->pid || (kill(s->pid, 0) == -1 && errno == ESRCH))
+        snprintf(state, sizeof(state), "stopped");
+    else if (s->failing_since)
+        snprintf(state, sizeof(state), "failing %llds",
+                 (long long)(wall - s->failing_since));
+    else
+        snprintf(state, sizeof(state), "ok");
+
+    char keepalive[32];
+    if (s->last_keepalive) {
+        snprintf(keepalive, sizeof(keepalive), "%llds ago",
+                 (long long)(wall - s->last_keepalive));
+    } else {
+        snprintf(keepalive, sizeof(keepalive), "-");
+    }
+
+    char p50[16];
+    char p90[16];
+    char p99[16];
+    if (secs) {
+        format_usec(p50, sizeof(p50), percentile(s->write_latency,
+                    old->write_latency, STATS_LATENCY_BUCKETS, 0.5));
+        format_usec(p90, sizeof(p90), percentile(s->write_latency,
+                    old->write_latency, STATS_LATENCY_BUCKETS, 0.9));
+        format_usec(p99, sizeof(p99), percentile(s->write_latency,
+                    old->write_latency, STATS_LATENCY_BUCKETS, 0.99));
+        printf("%-12.12s %7llu %-12s %8.1f %8.1f %7llu %9llu %7llu %6llu "
+               "%7s %7s %7s %s\n", base, (unsigned long long)s->pid, state,
+               (s->messages - old->messages) / secs,
+               (s->bytes_written - old->bytes_written) / secs / 1024,
+               (unsigned long long)s->queued,
+               (unsigned long long)s->queued_bytes,
+               (unsigned long long)s->dropped,
+               (unsigned long long)s->reconnects, p50, p90, p99, keepalive);
+    } else {
+        printf("%-12.12s %7llu %-12s %8s %8s %7llu %9llu %7llu %6llu "
+               "%7s %7s %7s %s\n", base, (unsigned long long)s->pid, state,
+               "-", "-", (unsigned long long)s->queued,
+               (unsigned long long)s->queued_bytes,
+               (unsigned long long)s->dropped,
+               (unsigned long long)s->reconnects, "-", "-", "-", keepalive);
+    }
+}
+
+static void refresh(int clear) {
+    long long now = now_msec();
+    time_t wall = time(NULL);
+    for (int i = 0; i < nb_devices; ++i)
+        take_snapshot(&devices[i], now);
+
+    char date[32];
+    struct tm ts;
+    localtime_r(&wall, &ts);
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &ts);
+
+    if (clear)
+        printf("\033[H\033[2J");
+    printf("mapper-devusb-top  %s  refresh %ld ms, rates over %.1f s\n\n",
+           date, interval, (nb_snapshots - 1) * sample / 1000.0);
+    printf("%-12s %7s %-12s %8s %8s %7s %9s %7s %6s %7s %7s %7s %s\n",
+           "DEVICE", "PID", "STATE", "MSG/S", "KB/S", "QUEUED", "QBYTES",
+           "DROPS", "RECON", "P50", "P90", "P99", "KEEPALIVE");
+    for (int i = 0; i < nb_devices; ++i) {
+        if (devices[i].nb)
+            show_device(&devices[i], wall);
+    }
+    if (!nb_devices)
+        printf("(no stats file in %s)\n", dir);
+    fflush(stdout);
+}
+
+static void restore_term() {
+    if (term_saved)
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved_term);
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    quit = 1;
+}
+
+    // Keys are read one by one, without echo
+static void setup_term() {
+    struct termios term;
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved_term))
+        return;
+    term = saved_term;
+    term.c_lflag &= ~(ICANON | ECHO);
+    term.c_cc[VMIN] = 1;
+    term.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &term))
+        return;
+    term_saved = 1;
+    atexit(restore_term);
+}
+
+    // Returns 1 if q was pressed
+static int wait_key(long long until) {
+    long long now;
+    while (!quit && (now = now_msec()) < until) {
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        if (term_saved)
+            FD_SET(STDIN_FILENO, &rfds);
+        struct timeval tv;
+        tv.tv_sec = (until - now) / 1000;
+        tv.tv_usec = ((until - now) % 1000) * 1000;
+        if (select(term_saved ? STDIN_FILENO + 1 : 0, &rfds, NULL, NULL,
+                   &tv) > 0) {
+            char c;
+            if (read(STDIN_FILENO, &c, 1) == 1 && (c == 'q' || c == 'Q'))
+                return 1;
+        }
+    }
+    return quit;
+}
+
+int main(int argc, char *argv[]) {
+    long count = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "hvd:i:w:n:")) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            exit(0);
+        case 'v':
+            printf("mapper-devusb-top version " VERSION "\n");
+            exit(0);
+        case 'd':
+            dir = optarg;
+            break;
+        case 'i':
+            if ((interval = atol(optarg)) <= 0) {
+                fprintf(stderr, "-i: positive number of ms expected\n");
+                exit(1);
+            }
+            break;
+        case 'w':
+            if ((window = atol(optarg)) <= 0) {
+                fprintf(stderr, "-w: positive number of seconds expected\n");
+                exit(1);
+            }
+            break;
+        case 'n':
+            if ((count = atol(optarg)) <= 0) {
+                fprintf(stderr, "-n: positive number expected\n");
+                exit(1);
+            }
+            break;
+        default:
+            fprintf(stderr, "Try `mapper-devusb-top -h' for more "
+                    "information.\n");
+            exit(1);
+        }
+    }
+
+        // One more than the refreshes of a window, the oldest one being its
+        // start. Too many: keep one every few refreshes.
+    long refreshes = window * 1000 / interval;
+    long stride = (refreshes + MAX_SNAPSHOTS - 2) / (MAX_SNAPSHOTS - 1);
+    if (stride < 1)
+        stride = 1;
+    sample = stride * interval;
+    nb_snapshots = refreshes / stride + 1;
+    if (nb_snapshots < 2)
+        nb_snapshots = 2;
+
+    if ((devices = calloc(MAX_DEVICES, sizeof(*devices))) == NULL) {
+        fprintf(stderr, "error: cannot allocate memory\n");
+        exit(1);
+    }
+    if (optind < argc) {
+        scan_dir = 0;
+        for (int i = optind; i < argc; ++i)
+            add_device(argv[i]);
+        if (!nb_devices) {
+            fprintf(stderr, "no mapper-devusb stats file (of version %d) "
+                    "given\n", STATS_VERSION);
+            exit(1);
+        }
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    setup_term();
+    int clear = isatty(STDOUT_FILENO);
+
+    long long next = now_msec();
+    long long next_scan = next;
+    while (count) {
+        if (scan_dir && next >= next_scan) {
+            scan();
+            next_scan = next + 1000;
+        }
+        refresh(clear);
+        if (count > 0)
+            --count;
+        next += interval;
+        if (count && wait_key(next))
+            break;
+    }
+
+    return 0;
+}
@@ -35,6 +35,8 @@
  * Arduino will trigger serial reset hopefully *before* a sending re-occurs.
 */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <sys/stat.h>
 #include <stdlib.h>
@@ -48,12 +50,37 @@
 #include <sys/time.h>
 #include <time.h>
 #include <linux/limits.h>
+#include <sys/ioctl.h>
+#include <sched.h>
+#include <ctype.h>
 
 #ifdef HAVE_SYSTEMD
 #include <systemd/sd-daemon.h>
 #endif
 
 #include "serial_speed.h"
+#include "util.h"
+#include "metrics.h"
+#include "profile.h"
+#include "probes.h"
+#include "pool.h"
+#include "stats.h"
+#include "slo.h"
+#include "worker.h"
+#include "queue.h"
+#include "control.h"
+#include "client_fifo.h"
+#include "devread.h"
+#include "query.h"
+#include "cache.h"
+#include "aggregate.h"
+#include "series.h"
+#include "pubsub.h"
+#include "dedup.h"
+#include "dispatch.h"
+#include "autotune.h"
+#include "busypoll.h"
+#include "vpty.h"
 
 /*
  * Should rather be set from Makefile
@@ -69,8 +96,8 @@
 #define DEFAULT_FIFO_FILE_NAME "/tmp/arduino"
 
     // Send a noop instruction to Arduino every that many seconds
-#define KEEPALIVE_WHILE_SUCCESS 60
-#define KEEPALIVE_WHILE_FAILURE 5
+int keepalive_while_success = 60;
+int keepalive_while_failure = 5;
 #define LOG_KEEPALIVE_NEVER  0
 #define LOG_KEEPALIVE_ERROR  1
 #define LOG_KEEPALIVE_ALWAYS 2
@@ -78,10 +105,30 @@ int log_keepalive = LOG_KEEPALIVE_ERROR;
     // Keepalive instruction
 const char *KEEPALIVE_CMD = "noop\n";
 
-int debug_on = 0;
 int run_as_a_daemon = 0;
-int log_usec = 0;
 int fifo_fd = -1;
+    // Device index, as reported in USDT probes, see device_number()
+int device_index = 0;
+    // Time device writes started to fail (usec), -1 while they succeed
+long long failing_since = -1;
+    // Of the last write to the device, -1 (failure) before the first one
+int last_write_buf_result = -1;
+long long keepalive_deadline;
+    // Messages are queued instead of written (control command pause)
+int paused = 0;
+
+    // What is read at once from the FIFO
+struct message {
+    ssize_t len;
+        // Time of the FIFO read (usec), latency is counted from there
+    long long received_at;
+    char buf[BUFSIZ];
+};
+
+    // Messages are read into a block from there. One is enough: a message is
+    // written or copied into the queue before the next read.
+struct pool message_pool;
+#define MESSAGE_POOL_SIZE 1
 
     // PATH_MAX + 1 to avoid warnings while compiling 'fortified'.
     // Warning comes from strncpy called by s_strncpy. It is:
@@ -99,75 +146,75 @@ char fifo_file_name[MY_PATH_MAX];
 char dev_file_name[MY_PATH_MAX];
     // Typically: /var/log/mapper-devusb/activity.log
 char log_file_name[MY_PATH_MAX];
-
-FILE *flog = NULL;
+    // Typically: /var/lib/mapper-devusb/metrics.prom, empty if no metrics
+char metrics_file_name[MY_PATH_MAX];
+    // Seconds between two writes of the metrics file
+int metrics_interval = 10;
+int profile_on = 0;
+    // Typically: /var/lib/mapper-devusb, empty if no statistics file
+char stats_dir[MY_PATH_MAX];
+    // Latency objective (ms), 0 if no objective
+long slo_latency = 0;
+    // Percentage of the messages that must meet slo_latency
+double slo_target = 99;
+    // Seconds over which slo_target is evaluated
+int slo_window = 300;
+    // Timers fire on multiples of it (ms), see align_deadline()
+long long timer_slack = 1000;
+    // Size of the queue of messages waiting for the device (kB), 0 to drop
+    // messages the device cannot take
+long queue_memory = 0;
+    // Where the queue overflows, empty to drop messages when it is full
+char spill_dir[MY_PATH_MAX];
+    // Queued messages written per loop iteration
+int drain_batch = 16;
+    // Paces writes to the device, see autotune.h (needs the queue)
+int autotune = 0;
+    // Milliseconds written data may wait before reaching the board
+long autotune_latency = 50;
+    // Bounds of the write rate (bytes per second), 0 for the line rate
+long autotune_rate_min = 100;
+long autotune_rate_max = 0;
+    // Queued messages written at once, at most
+long autotune_batch_max = 16;
+    // Typically: /run/mapper-devusb/control, empty if no control socket
+char control_file_name[MY_PATH_MAX];
+    // Seconds after which an unused client FIFO is removed
+int client_fifo_idle = 300;
+    // Keep the device open to read what the board prints
+int read_device = 0;
+    // Milliseconds to wait for the answer to a query
+int query_timeout = 1000;
+    // Lines read from the board are identified by their field number
+    // key_field, fields being separated by blanks or field_separators. The
+    // next field is their value.
+int key_field = 1;
+char field_separators[16] = ":=";
+char separators[sizeof(field_separators) + 2];
+    // Keys of the latest-value cache, 0 if no cache
+long cache_size = 0;
+    // Milliseconds a cached line stays valid, unless the client tells
+long cache_max_age = 1000;
+    // Query sent for a key missing from the cache: prefix, key, suffix
+char cache_query_prefix[QUERY_MAX + 1] = "";
+char cache_query_suffix[QUERY_MAX + 1] = "?";
+    // Values read from the board are stored there, empty if not stored
+char series_dir[MY_PATH_MAX];
+    // Seconds of samples per chunk file
+int series_chunk = 86400;
+    // kB of idempotency keys remembered, 0 if messages have no key
+long dedup_memory = 0;
+    // Seconds a key is remembered
+int dedup_window = 600;
+    // Writes the metrics file from a background thread
+int background_worker = 1;
+    // CPU the daemon is pinned to, -1 if not pinned
+int cpu = -1;
+    // Microseconds the loop polls its fds before sleeping, 0 to sleep at once
+long busy_poll = 0;
 
 int clear_hupcl(const int fd);
 
-void output_datetime_of_day(FILE *f) {
-    if (!f)
-        return;
-
-    time_t ltime = time(NULL);
-    struct tm ts;
-    ts = *localtime(&ltime);
-
-    struct timeval tv;
-    struct timezone tz;
-    if (gettimeofday(&tv, &tz)) {
-        fprintf(f, "[gettimeofday(): error]  ");
-        return;
-    }
-
-    if (log_usec) {
-        fprintf(f, "%02i/%02i/%02i %02i:%02i:%02i.%06lu ",
-                ts.tm_mday, ts.tm_mon + 1, ts.tm_year % 100,
-                ts.tm_hour, ts.tm_min, ts.tm_sec, tv.tv_usec);
-    } else {
-        fprintf(f, "%02i/%02i/%02i %02i:%02i:%02i ",
-                ts.tm_mday, ts.tm_mon + 1, ts.tm_year % 100,
-                ts.tm_hour, ts.tm_min, ts.tm_sec);
-    }
-}
-
-void DBG(const char *fmt, ...)
-     __attribute__((format(printf, 1, 2)));
-#ifdef DEBUG
-void DBG(const char *fmt, ...) {
-    if (!debug_on)
-        return;
-
-    if (!flog)
-        return;
-
-    output_datetime_of_day(flog);
-    fprintf(flog, "%s", "[D] ");
-    va_list args;
-    va_start(args, fmt);
-    vfprintf(flog, fmt, args);
-    va_end(args);
-    fprintf(flog, "\n");
-    fflush(flog);
-}
-#else
-#define DBG(...)
-#endif
-void l(const char *fmt, ...)
-     __attribute__((format(printf, 1, 2)));
-void l(const char *fmt, ...) {
-    if (!flog)
-        return;
-
-    output_datetime_of_day(flog);
-    fprintf(flog, "%s", "    ");
-    va_list args;
-    va_start(args, fmt);
-    vfprintf(flog, fmt, args);
-    va_end(args);
-    fprintf(flog, "\n");
-    fflush(flog);
-}
-
 void usage() {
     printf("Usage:\n\
   mapper-devusb [OPTIONS] [DEVICE_FILE]\n\
@@ -188,6 +235,7 @@ to set options. See file installed by default.\n\
            fork()). It is not compatible with systemd service management.\n\
   -l FILE  Logs data into FILE\n\
   -f FIFO  FIFO to use\n\
+  -s FILE  Control socket to use\n\
   -D       Print out debug information\n\
 \n\
 Copyright 2019, 2020 Sébastien Millet\n");
@@ -197,19 +245,17 @@ void version() {
     printf("mapper-devusb version " VERSION "\n");
 }
 
-void s_strncpy(char *dest, const char *src, size_t n) {
-    if (n >= 1) {
-        strncpy(dest, src, n - 1);
-        dest[n - 1] = '\0';
-    }
-}
-
-void remove_trailing_newline(char *s) {
-    size_t l = strlen(s);
-    if (l >= 1 && s[l - 1] == '\n')
-        s[--l] = '\0';
-    if (l >= 1 && s[l - 1] == '\r')
-        s[--l] = '\0';
+    // Number ending the device file name, symlinks resolved if it exists (3
+    // for /dev/ttyACM3), 0 if none: tells apart the daemons of a fleet in
+    // probes
+int device_number(const char *name) {
+    char path[MY_PATH_MAX];
+    if (realpath(name, path) == NULL)
+        s_strncpy(path, name, sizeof(path));
+    size_t n = strlen(path);
+    while (n && isdigit((unsigned char)path[n - 1]))
+        --n;
+    return atoi(path + n);
 }
 
 int clear_hupcl(const int fd) {
@@ -230,15 +276,21 @@ int clear_hupcl(const int fd) {
 // Sends bytes to the device.
 // Returns 0 if success, -1 if failure.
 int write_buf(const char *buf, size_t len, int stay_silent_if_error) {
+    long long start = (stats || autotune_enabled() ? now_usec() : 0);
+
     int out_fd;
     if ((out_fd = open(dev_file_name, O_WRONLY)) == -1) {
         if (!stay_silent_if_error) {
             l("error: cannot open '%s': %s", dev_file_name, strerror(errno));
         }
+        ++metrics.write_errors;
+        stats_write(-1, 0);
         return -1;
     }
+    PROBE(device_opened, device_index, out_fd);
 
     int retval = 0;
+    ssize_t written = -1;
     do {
         if (clear_hupcl(out_fd)) {
             if (!stay_silent_if_error) {
@@ -254,17 +306,32 @@ int write_buf(const char *buf, size_t len, int stay_silent_if_error) {
             break;
         }
 
-        if (write(out_fd, buf, len) == -1) {
+        if ((written = write(out_fd, buf, len)) == -1) {
             if (!stay_silent_if_error) {
                 l("error: write to device file: %s", strerror(errno));
             }
             retval = -1;
             break;
         }
+        metrics.bytes_written += written;
+        PROBE(written, device_index, written);
     } while (0);
 
+        // What the board has not taken yet
+    int outq = 0;
+    if (!retval && autotune_enabled() && ioctl(out_fd, TIOCOUTQ, &outq))
+        outq = 0;
+
+    PROBE(device_closed, device_index, out_fd);
     close(out_fd);
 
+    if (retval)
+        ++metrics.write_errors;
+    long long end = (stats || autotune_enabled() ? now_usec() : 0);
+    stats_write(retval ? -1 : written, end - start);
+    if (!retval)
+        autotune_observe(written, end - start, outq, end / 1000);
+
     return retval;
 }
 
@@ -333,7 +400,23 @@ void close_log() {
     }
 }
 
+    // Tells queue_close() whether the i-th queued message got cancelled
+int queued_cancelled(unsigned long i) {
+    return dispatch_cancelled(dispatch_head_id() + i);
+}
+
 void exit_handler() {
+    control_close();
+    client_fifo_close_all();
+    vpty_close_all();
+    devread_close();
+    worker_stop();
+    queue_close(queued_cancelled, dispatch_queued_cancelled());
+    if (strlen(metrics_file_name))
+        metrics_write(metrics_file_name);
+    profile_close();
+    stats_close();
+    series_close();
     l("termination");
     close_log();
 }
@@ -350,24 +433,6 @@ void get_required_argument(int *idx, int argc, char *argv[],
     }
 }
 
-int str_to_boolean(const char *s) {
-    if (!strcmp(s, "0") || !strcmp(s, "no") || !strcmp(s, "n")
-            || !strcmp(s, ""))
-        return 0;
-    return 1;
-}
-
-char *trim(char *s) {
-    int p = strlen(s) - 1;
-    while (p >= 0 && (s[p] == ' ' || s[p] == '\t')) {
-        s[p] = '\0';
-        --p;
-    }
-    while (*s == ' ' || *s == '\t')
-        ++s;
-    return s;
-}
-
 void read_cfg_from_cmdline_opts_round1(int argc, char *argv[]) {
     for (int i = 1; i < argc; ++i) {
         if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
@@ -389,17 +454,22 @@ void read_cfg_from_config_file() {
         fprintf(stderr, "%s: error: unable to open for reading\n", abs_cfgfile);
         exit(EXIT_FAILURE);
     } else {
-        ssize_t nb;
-        size_t z = 0;
-        char *line = NULL;
+            // No getline(): it allocates.
+        char line[PATH_MAX];
         char tmp_varname[PATH_MAX]; // PATH_MAX might look weird here... Don't
                                     // know what other constant I could use
                                     // instead.
         char *tmp_varval;
         int line_no = 0;
-        while ((nb = getline(&line, &z, config)) != -1) {
+        while (fgets(line, sizeof(line), config)) {
             ++line_no;
 
+            if (!strchr(line, '\n') && !feof(config)) {
+                fprintf(stderr, "%s:%i: error: line too long\n",
+                    abs_cfgfile, line_no);
+                exit(EXIT_FAILURE);
+            }
+
             int idx;
             for (idx = 0; line[idx] != '\0'; ++idx) {
                 if (line[idx] != ' ' && line[idx] != '\t')
@@ -449,15 +519,200 @@ void read_cfg_from_config_file() {
                 }
             } else if (!strcmp(varname, "log_usec")) {
                 log_usec = str_to_boolean(varval);
+            } else if (!strcmp(varname, "metrics")) {
+                s_strncpy(metrics_file_name, varval,
+                          sizeof(metrics_file_name));
+            } else if (!strcmp(varname, "metrics_interval")) {
+                metrics_interval = atoi(varval);
+                if (metrics_interval <= 0) {
+                    fprintf(stderr, "%s:%i: error: metrics_interval: must be "
+                        "a positive number of seconds\n", abs_cfgfile,
+                        line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "profile")) {
+                profile_on = str_to_boolean(varval);
+            } else if (!strcmp(varname, "stats_dir")) {
+                s_strncpy(stats_dir, varval, sizeof(stats_dir));
+            } else if (!strcmp(varname, "timer_slack")) {
+                timer_slack = atoll(varval);
+                if (timer_slack < 0) {
+                    fprintf(stderr, "%s:%i: error: timer_slack: must be "
+                        "a number of milliseconds\n", abs_cfgfile, line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "queue_memory")) {
+                queue_memory = atol(varval);
+                if (queue_memory < 0) {
+                    fprintf(stderr, "%s:%i: error: queue_memory: must be "
+                        "a number of kB\n", abs_cfgfile, line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "spill_dir")) {
+                s_strncpy(spill_dir, varval, sizeof(spill_dir));
+            } else if (!strcmp(varname, "autotune")) {
+                autotune = str_to_boolean(varval);
+            } else if (!strcmp(varname, "autotune_latency")) {
+                autotune_latency = atol(varval);
+                if (autotune_latency <= 0) {
+                    fprintf(stderr, "%s:%i: error: autotune_latency: must be "
+                        "a positive number of milliseconds\n", abs_cfgfile,
+                        line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "autotune_rate_min")) {
+                autotune_rate_min = atol(varval);
+                if (autotune_rate_min <= 0) {
+                    fprintf(stderr, "%s:%i: error: autotune_rate_min: must "
+                        "be a positive number of bytes per second\n",
+                        abs_cfgfile, line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "autotune_rate_max")) {
+                autotune_rate_max = atol(varval);
+                if (autotune_rate_max < 0) {
+                    fprintf(stderr, "%s:%i: error: autotune_rate_max: must "
+                        "be a number of bytes per second\n", abs_cfgfile,
+                        line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "autotune_batch_max")) {
+                autotune_batch_max = atol(varval);
+                if (autotune_batch_max <= 0) {
+                    fprintf(stderr, "%s:%i: error: autotune_batch_max: must "
+                        "be a positive number of messages\n", abs_cfgfile,
+                        line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "control")) {
+                s_strncpy(control_file_name, varval,
+                          sizeof(control_file_name));
+            } else if (!strcmp(varname, "client_fifo_idle")) {
+                client_fifo_idle = atoi(varval);
+                if (client_fifo_idle <= 0) {
+                    fprintf(stderr, "%s:%i: error: client_fifo_idle: must be "
+                        "a positive number of seconds\n", abs_cfgfile,
+                        line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "read_device")) {
+                read_device = str_to_boolean(varval);
+            } else if (!strcmp(varname, "query_timeout")) {
+                query_timeout = atoi(varval);
+                if (query_timeout <= 0) {
+                    fprintf(stderr, "%s:%i: error: query_timeout: must be "
+                        "a positive number of milliseconds\n", abs_cfgfile,
+                        line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "cache_size")) {
+                cache_size = atol(varval);
+                if (cache_size < 0) {
+                    fprintf(stderr, "%s:%i: error: cache_size: must be "
+                        "a number of keys\n", abs_cfgfile, line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "key_field")) {
+                key_field = atoi(varval);
+                if (key_field <= 0) {
+                    fprintf(stderr, "%s:%i: error: key_field: must be "
+                        "a field number, 1 for the first\n", abs_cfgfile,
+                        line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "field_separators")) {
+                s_strncpy(field_separators, varval, sizeof(field_separators));
+            } else if (!strcmp(varname, "cache_max_age")) {
+                cache_max_age = atol(varval);
+                if (cache_max_age <= 0) {
+                    fprintf(stderr, "%s:%i: error: cache_max_age: must be "
+                        "a positive number of milliseconds\n", abs_cfgfile,
+                        line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "cache_query")) {
+                char *key = strstr(varval, "%s");
+                if (!key || strchr(key + 2, '%') || strchr(varval, '%') != key
+                        || strlen(varval) > QUERY_MAX) {
+                    fprintf(stderr, "%s:%i: error: cache_query: must contain "
+                        "%%s once, and no other %%\n", abs_cfgfile, line_no);
+                    exit(EXIT_FAILURE);
+                }
+                *key = '\0';
+                s_strncpy(cache_query_prefix, varval,
+                          sizeof(cache_query_prefix));
+                s_strncpy(cache_query_suffix, key + 2,
+                          sizeof(cache_query_suffix));
+            } else if (!strcmp(varname, "series_dir")) {
+                s_strncpy(series_dir, varval, sizeof(series_dir));
+            } else if (!strcmp(varname, "series_chunk")) {
+                series_chunk = atoi(varval);
+                if (series_chunk <= 0 || series_chunk > 1000000) {
+                    fprintf(stderr, "%s:%i: error: series_chunk: must be "
+                        "a number of seconds, up to 1000000\n", abs_cfgfile,
+                        line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "dedup_memory")) {
+                dedup_memory = atol(varval);
+                if (dedup_memory < 0) {
+                    fprintf(stderr, "%s:%i: error: dedup_memory: must be "
+                        "a number of kB\n", abs_cfgfile, line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "dedup_window")) {
+                dedup_window = atoi(varval);
+                if (dedup_window <= 0) {
+                    fprintf(stderr, "%s:%i: error: dedup_window: must be "
+                        "a positive number of seconds\n", abs_cfgfile,
+                        line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "background_worker")) {
+                background_worker = str_to_boolean(varval);
+            } else if (!strcmp(varname, "cpu")) {
+                cpu = atoi(varval);
+                if (cpu < 0 || cpu >= CPU_SETSIZE) {
+                    fprintf(stderr, "%s:%i: error: cpu: must be a CPU "
+                        "number\n", abs_cfgfile, line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "busy_poll")) {
+                busy_poll = atol(varval);
+                if (busy_poll < 0) {
+                    fprintf(stderr, "%s:%i: error: busy_poll: must be "
+                        "a number of microseconds\n", abs_cfgfile, line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "slo_latency")) {
+                slo_latency = atol(varval);
+                if (slo_latency < 0) {
+                    fprintf(stderr, "%s:%i: error: slo_latency: must be "
+                        "a number of milliseconds\n", abs_cfgfile, line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "slo_target")) {
+                slo_target = atof(varval);
+                if (slo_target <= 0 || slo_target > 100) {
+                    fprintf(stderr, "%s:%i: error: slo_target: must be "
+                        "a percentage, above 0 and up to 100\n", abs_cfgfile,
+                        line_no);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strcmp(varname, "slo_window")) {
+                slo_window = atoi(varval);
+                if (slo_window <= 0) {
+                    fprintf(stderr, "%s:%i: error: slo_window: must be "
+                        "a positive number of seconds\n", abs_cfgfile,
+                        line_no);
+                    exit(EXIT_FAILURE);
+                }
             } else {
                 fprintf(stderr, "%s:%i: error: unknown variable '%s'\n",
                     abs_cfgfile, line_no, varname);
                 exit(EXIT_FAILURE);
             }
         }
-        if (line)
-            free(line);
-
         if (!feof(config)) {
             fprintf(stderr, "%s: error reading\n", abs_cfgfile);
             exit(EXIT_FAILURE);
@@ -480,6 +735,9 @@ void read_cfg_from_cmdline_opts_round2(int argc, char *argv[]) {
         } else if (!strcmp(argv[i], "-f")) {
             get_required_argument(&i, argc, argv, "f",
                 fifo_file_name, sizeof(fifo_file_name));
+        } else if (!strcmp(argv[i], "-s")) {
+            get_required_argument(&i, argc, argv, "s",
+                control_file_name, sizeof(control_file_name));
         } else if (!strcmp(argv[i], "-c")) {
                 // Option -c got already taken into account (in
                 // read_cfg_from_cmdline_opts_round1), but still, we must
@@ -505,26 +763,858 @@ void read_cfg_from_cmdline_opts_round2(int argc, char *argv[]) {
     }
 }
 
+void on_write_buf_result(int result) {
+    if (result) {
+        if (failing_since == -1) {
+            failing_since = now_usec();
+            stats_failing();
+        }
+    } else if (failing_since != -1) {
+        long long downtime = now_usec() - failing_since;
+        PROBE(reconnect, device_index, downtime);
+        stats_reconnect(downtime);
+        failing_since = -1;
+    }
+}
+
+    // Delay before next keepalive, in milliseconds
+long long keepalive_delay(int last_result) {
+    return (last_result == 0 ?
+            keepalive_while_success : keepalive_while_failure) * 1000LL;
+}
+
+    // Returns the id of the message in the queue (see dispatch.h), 0 if lost
+    // key: hash of the idempotency key of the message, 0 if none
+unsigned long enqueue(const char *buf, size_t len, long long received_at,
+                      int source, const char *name, uint64_t key) {
+    static int full = 0;
+
+        // The queue keeps wall clock time, messages may outlive the run
+    int r = queue_push(buf, len, received_at - now_usec() + wall_usec());
+    if (r == -1) {
+        if (!full)
+            l("error: queue full, messages are lost");
+        full = 1;
+        PROBE(dropped, device_index, len);
+        stats_dropped();
+        return 0;
+    }
+    if (full)
+        l("queue accepts messages again");
+    full = 0;
+    if (r == QUEUE_SPILLED)
+        PROBE(spilled, device_index, len);
+    else
+        PROBE(enqueued, device_index, len);
+    unsigned long id = dispatch_pushed(source, name, len, key);
+    DBG("queued as %lu", id);
+    return id;
+}
+
+    // With idempotency keys, a message starting with @KEY and a blank gets
+    // KEY in *key (key_len bytes), and is stripped of it.
+    // Returns 1 if the key was seen recently: the message must not be
+    // written.
+int check_key(char **buf, ssize_t *len, const char **key, size_t *key_len) {
+    *key = NULL;
+    if (!dedup_enabled() || (*buf)[0] != '@')
+        return 0;
+    size_t n = 1;
+    while (n < (size_t)*len && n <= DEDUP_KEY_MAX + 1
+            && (*buf)[n] != ' ' && (*buf)[n] != '\t' && (*buf)[n] != '\n')
+        ++n;
+    if (n == 1 || n > DEDUP_KEY_MAX + 1 || n == (size_t)*len
+            || (*buf)[n] == '\n')
+        return 0;
+
+    *key = *buf + 1;
+    *key_len = n - 1;
+    if (dedup_seen(*key, *key_len, now_msec())) {
+        l("duplicate of key %.*s, not written", (int)*key_len, *key);
+        return 1;
+    }
+    *buf += n + 1;
+    *len -= n + 1;
+    return 0;
+}
+
+    // What became of a message, see forward()
+#define FORWARD_WRITTEN   0
+#define FORWARD_QUEUED    1
+#define FORWARD_DUPLICATE 2
+#define FORWARD_LOST      3
+
+    // Writes a message received from source (named name) at received_at
+    // (usec), or queues it, setting *id.
+    // Returns FORWARD_WRITTEN, FORWARD_QUEUED, FORWARD_DUPLICATE or
+    // FORWARD_LOST.
+int forward(char *buf, ssize_t len, long long received_at, int source,
+            const char *name, unsigned long *id) {
+    const char *key;
+    size_t key_len;
+    int result;
+    if (check_key(&buf, &len, &key, &key_len)) {
+            // Acknowledged by the log line and the counter only
+        PROBE(coalesced, device_index, len);
+        return FORWARD_DUPLICATE;
+    }
+    uint64_t key_hash = (key ? dedup_hash(key, key_len) : 0);
+    if (queue_enabled() && (paused || !queue_empty()
+                                   || !autotune_take(len, now_msec()))) {
+            // Behind the messages already waiting, to keep order, or waiting
+            // for the rate to allow it
+        *id = enqueue(buf, len, received_at, source, name, key_hash);
+        result = (*id ? FORWARD_QUEUED : FORWARD_LOST);
+            // Recorded once written, see drain_queue()
+        if (result == FORWARD_LOST)
+            slo_record(now_usec(), now_usec() - received_at, 0);
+    } else {
+        profile_stage_end(STAGE_DISPATCH);
+        last_write_buf_result = write_buf(buf, len, 0);
+        profile_stage_end(STAGE_WRITE);
+        on_write_buf_result(last_write_buf_result);
+        if (!last_write_buf_result) {
+            result = FORWARD_WRITTEN;
+        } else if (queue_enabled()) {
+            *id = enqueue(buf, len, received_at, source, name, key_hash);
+            result = (*id ? FORWARD_QUEUED : FORWARD_LOST);
+        } else {
+            PROBE(dropped, device_index, len);
+            stats_dropped();
+            result = FORWARD_LOST;
+        }
+        long long written_at = now_usec();
+        if (result != FORWARD_QUEUED) {
+            slo_record(written_at, written_at - received_at,
+                       !last_write_buf_result);
+        }
+        slo_check(written_at);
+        keepalive_deadline =
+            now_msec() + keepalive_delay(last_write_buf_result);
+    }
+        // A retry of a message that got lost must go through
+    if (result != FORWARD_LOST && key)
+        dedup_add(key, key_len, now_msec());
+    return result;
+}
+
+    // A queued message got written: its latency goes to the SLO.
+    // received_at: wall clock time, as kept by the queue
+void record_replayed(long long received_at) {
+    long long latency = wall_usec() - received_at;
+    slo_record(now_usec(), latency > 0 ? latency : 0, 1);
+}
+
+#define MAX_BATCH 256
+
+struct batch {
+    char buf[BUFSIZ];
+    size_t len;
+    unsigned long messages;     // Taken from the queue, cancelled ones too
+    unsigned long max;
+    long long received_at[MAX_BATCH];
+};
+
+int add_to_batch(const char *buf, size_t len, long long received_at,
+                 void *arg) {
+    struct batch *b = arg;
+    if (b->messages == b->max || b->messages == MAX_BATCH
+            || (b->messages && b->len + len > sizeof(b->buf)))
+        return 1;
+    b->received_at[b->messages] = -1;
+    if (!dispatch_cancelled(dispatch_head_id() + b->messages)) {
+        memcpy(b->buf + b->len, buf, len);
+        b->len += len;
+        b->received_at[b->messages] = received_at;
+    }
+    ++b->messages;
+    return 0;
+}
+
+    // With autotune: queued messages, up to the batch size, are written at
+    // once.
+    // Returns the result of write_buf().
+int drain_batched() {
+    static struct batch b;
+
+    b.len = 0;
+    b.messages = 0;
+    b.max = autotune_stats.batch;
+    queue_dump(add_to_batch, &b, b.max);
+    if (b.len) {
+        autotune_take(b.len, now_msec());
+        int r = write_buf(b.buf, b.len, 0);
+        on_write_buf_result(r);
+        if (r)
+            return r;
+        PROBE(replayed, device_index, b.len);
+    }
+        // Messages read back from segments included, see queue_pop()
+    for (unsigned long i = 0; i < b.messages && !queue_pop(); ++i) {
+        if (b.received_at[i] != -1)
+            record_replayed(b.received_at[i]);
+        dispatch_popped();
+    }
+    slo_check(now_usec());
+    return 0;
+}
+
+    // Writes queued messages, a batch per loop iteration so that the FIFO
+    // keeps being read meanwhile.
+    // Returns the result of the last write_buf().
+int drain_queue() {
+    static char buf[BUFSIZ];
+
+    if (autotune_enabled())
+        return drain_batched();
+    for (int i = 0; i < drain_batch; ++i) {
+        size_t len;
+        long long received_at;
+        if (!(len = queue_peek(buf, sizeof(buf), &received_at)))
+            break;
+        if (dispatch_cancelled(dispatch_head_id())) {
+            queue_pop();
+            dispatch_popped();
+            continue;
+        }
+        int r = write_buf(buf, len, 0);
+        on_write_buf_result(r);
+        if (r)
+            return r;
+        PROBE(replayed, device_index, len);
+        record_replayed(received_at);
+        queue_pop();
+        dispatch_popped();
+    }
+    slo_check(now_usec());
+    return 0;
+}
+
+    // Queued messages can be written, possibly not yet (see must_drain())
+int queue_waits() {
+    return (queue_enabled() && !queue_empty() && !last_write_buf_result
+            && !paused);
+}
+
+int must_drain() {
+    return queue_waits() && autotune_ready_at(now_msec()) == -1;
+}
+
+    // Every line the board prints
+void on_device_line(const char *line, size_t len) {
+    DBG("device: [%s]", line);
+    char key[DEVREAD_KEY_MAX + 1];
+    if (!get_field(line, len, key_field, separators, key, sizeof(key))) {
+        long long now = now_msec();
+        cache_update(key, line, len, now);
+
+        char value[64];
+        if (!get_field(line, len, key_field + 1, separators, value,
+                       sizeof(value))) {
+            char *end;
+            double v = strtod(value, &end);
+            if (end != value && *end == '\0') {
+                aggregate_sample(key, v);
+                series_add(key, v);
+            }
+        }
+    }
+    query_response(line, len);
+    pubsub_publish(line, len);
+    vpty_publish(line, len);
+}
+
+    // Opens the device for reading if it is not already
+void open_device_for_reading() {
+    if (read_device && devread_fd() == -1)
+        devread_open(dev_file_name, on_device_line);
+}
+
+    // Like a message (see forward()): held back while paused, behind queued
+    // messages, or until the rate allows it
+int write_query(const char *buf, size_t len) {
+    if (queue_enabled() && (paused || !queue_empty()
+                                   || !autotune_take(len, now_msec())))
+        return 1;
+    last_write_buf_result = write_buf(buf, len, 0);
+    on_write_buf_result(last_write_buf_result);
+    keepalive_deadline = now_msec() + keepalive_delay(last_write_buf_result);
+    return last_write_buf_result;
+}
+
+int dump_message(const char *buf, size_t len, long long received_at,
+                 void *arg) {
+    (void)received_at;
+    unsigned long *n = arg;
+    char line[256];
+    size_t j = 0;
+    for (size_t i = 0; i < len && j < sizeof(line) - 5; ++i) {
+        if (buf[i] == '\n' && i == len - 1)
+            break;
+        if (buf[i] == '\n') {
+            line[j++] = '\\';
+            line[j++] = 'n';
+        } else {
+            line[j++] = buf[i];
+        }
+    }
+    if (j >= sizeof(line) - 5)
+        j += sprintf(line + j, "...");
+    line[j] = '\0';
+    unsigned long id = dispatch_head_id() + (*n)++;
+    control_printf("%lu: [%s]%s\n", id, line,
+                   dispatch_cancelled(id) ? " cancelled" : "");
+    return 0;
+}
+
+    // Registers a query for the client whose command runs
+int submit_query(const char *query) {
+    int r;
+    if ((r = query_submit(query, control_client())) == -1) {
+        control_printf("error: %s\n", errno == EBUSY ?
+                       "too many queries pending" : strerror(errno));
+        return -1;
+    }
+    if (r)
+        PROBE(coalesced, device_index, strlen(query));
+    return CONTROL_PENDING;
+}
+
+    // Parses a positive number for a control command
+int control_number(const char *arg, long *value) {
+    char *end;
+    *value = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || *value <= 0) {
+        control_printf("error: '%s': positive number expected\n", arg);
+        return -1;
+    }
+    return 0;
+}
+
+int control_command(int argc, char *argv[]) {
+    const char *cmd = argv[0];
+    long value;
+
+    if (!strcmp(cmd, "help")) {
+            // One line per call, control_printf() output being size-limited
+        static const char *const help[] = {
+            "status                   device, queue and settings\n",
+            "pause                    queue messages, do not write them\n",
+            "resume                   write messages again\n",
+            "flush                    write queued messages now\n",
+            "drop                     remove queued messages\n",
+            "reconnect                probe the device now\n",
+            "dump [N]                 display the first N queued messages "
+            "(default 20)\n",
+            "send MESSAGE             write MESSAGE, or queue it and display "
+            "its id\n",
+            "cancel ID...             skip queued messages\n",
+            "cancel from SOURCE       skip queued messages of SOURCE (main, "
+            "control or a FIFO)\n",
+            "set keepalive S          keepalive period, seconds\n",
+            "set keepalive_failure S  same, while writes fail\n",
+            "set drain_batch N        queued messages written per loop "
+            "iteration\n",
+            "set autotune_latency MS  autotune target latency\n",
+            "set autotune_rate_min B  autotune rate bounds, bytes per second\n",
+            "set autotune_rate_max B\n",
+            "set autotune_batch_max N autotune messages written at once, at "
+            "most\n",
+            "fifo NAME                create private FIFO NAME\n",
+            "pty NAME                 create pseudo-terminal NAME\n",
+            "close NAME               remove private FIFO or pty NAME\n",
+            "clients                  list private FIFOs and ptys\n",
+            "query CMD                send CMD to the board, display its "
+            "answer\n",
+            "get KEY [MS]             latest line of KEY, queried if older "
+            "than MS\n",
+            "subscribe KEY MS         summary of the values of KEY every MS\n",
+            "unsubscribe KEY          stop summaries of KEY\n",
+            "watch DEV/PREFIX [drop|disconnect]\n"
+            "                         lines of DEV (or *) starting with "
+            "PREFIX\n",
+            "unwatch DEV/PREFIX       stop lines matching DEV/PREFIX\n",
+        };
+        for (size_t i = 0; i < sizeof(help) / sizeof(*help); ++i)
+            control_printf("%s", help[i]);
+    } else if (!strcmp(cmd, "status")) {
+        control_printf("device: %s (%s)\n", dev_file_name,
+                       last_write_buf_result ? "failing" : "ok");
+        control_printf("paused: %s\n", paused ? "yes" : "no");
+        if (queue_enabled()) {
+            control_printf("queue: %lu message(s), %lu bytes in memory, "
+                           "%llu bytes on disk\n", queue_stats.messages,
+                           (unsigned long)queue_stats.memory_bytes,
+                           queue_stats.disk_bytes);
+        }
+        control_printf("keepalive: %d s, %d s while failing\n",
+                       keepalive_while_success, keepalive_while_failure);
+        control_printf("drain_batch: %d\n", drain_batch);
+        if (autotune_enabled()) {
+            control_printf("autotune: %lu bytes/s (%ld to %ld), batch %lu "
+                           "(up to %ld), latency %lu ms (target %ld)\n",
+                           autotune_stats.rate, autotune_rate_min,
+                           autotune_rate_max, autotune_stats.batch,
+                           autotune_batch_max, autotune_stats.latency,
+                           autotune_latency);
+        }
+    } else if (!strcmp(cmd, "pause")) {
+        if (!queue_enabled()) {
+            control_printf("error: pause needs option queue_memory\n");
+            return -1;
+        }
+        paused = 1;
+        l("control: paused");
+    } else if (!strcmp(cmd, "resume")) {
+        paused = 0;
+        l("control: resumed");
+    } else if (!strcmp(cmd, "flush")) {
+        if (paused) {
+            control_printf("error: paused\n");
+            return -1;
+        }
+            // Drain even if the last write failed
+        if (last_write_buf_result)
+            last_write_buf_result = 0;
+        l("control: flush");
+    } else if (!strcmp(cmd, "drop")) {
+        unsigned long n = queue_clear();
+        dispatch_cleared();
+        control_printf("%lu message(s) dropped\n", n);
+        l("control: %lu queued message(s) dropped", n);
+    } else if (!strcmp(cmd, "reconnect")) {
+        keepalive_deadline = 0;
+        l("control: reconnect");
+    } else if (!strcmp(cmd, "dump")) {
+        value = 20;
+        if (argc >= 2 && control_number(argv[1], &value))
+            return -1;
+        unsigned long n = 0;
+        queue_dump(dump_message, &n, value);
+    } else if (!strcmp(cmd, "send") && argc >= 2) {
+            // Not rebuilt from argv, that has a limited number of words and
+            // no longer knows the blanks between them
+        char buf[BUFSIZ];
+        size_t len = snprintf(buf, sizeof(buf), "%s\n", control_rest());
+        profile_start();
+        l("control: send [%.*s]", (int)len - 1, buf);
+        PROBE(received, device_index, len);
+        ++metrics.messages;
+        metrics.bytes_received += len;
+        stats_message(len);
+        profile_stage_end(STAGE_INGEST);
+        unsigned long id;
+        switch (forward(buf, len, now_usec(), DISPATCH_SOURCE_CONTROL,
+                        "control", &id)) {
+        case FORWARD_WRITTEN:
+            control_printf("written\n");
+            break;
+        case FORWARD_QUEUED:
+            control_printf("queued: %lu\n", id);
+            break;
+        case FORWARD_DUPLICATE:
+            control_printf("duplicate\n");
+            break;
+        default:
+            control_printf("error: message lost\n");
+            return -1;
+        }
+    } else if (!strcmp(cmd, "cancel") && argc == 3
+               && !strcmp(argv[1], "from")) {
+        int source;
+        struct client_fifo *c;
+        struct vpty *p;
+        if (!strcmp(argv[2], "main")) {
+            source = DISPATCH_SOURCE_MAIN;
+        } else if (!strcmp(argv[2], "control")) {
+            source = DISPATCH_SOURCE_CONTROL;
+        } else if ((c = client_fifo_find(argv[2])) != NULL) {
+            source = DISPATCH_SOURCE_FIFO(c - client_fifos);
+        } else if ((p = vpty_find(argv[2])) != NULL) {
+            source = DISPATCH_SOURCE_PTY(p - vptys);
+        } else {
+            control_printf("error: '%s': unknown source\n", argv[2]);
+            return -1;
+        }
+        unsigned long n = dispatch_cancel_source(source, argv[2]);
+        control_printf("%lu message(s) cancelled\n", n);
+        l("control: %lu queued message(s) from %s cancelled", n, argv[2]);
+    } else if (!strcmp(cmd, "cancel") && argc >= 2) {
+        for (int i = 1; i < argc; ++i) {
+            if (control_number(argv[i], &value))
+                return -1;
+            if (dispatch_cancel(value)) {
+                control_printf("error: %ld: not queued, or no longer "
+                               "cancellable\n", value);
+                return -1;
+            }
+            l("control: queued message %ld cancelled", value);
+        }
+    } else if (!strcmp(cmd, "fifo") && argc == 2) {
+        struct client_fifo *c;
+        if ((c = client_fifo_open(argv[1])) == NULL) {
+            control_printf("error: fifo '%s': %s\n", argv[1],
+                           errno == EINVAL ? "name must be made of letters, "
+                           "digits, - and _" : strerror(errno));
+            return -1;
+        }
+        char path[MY_PATH_MAX + CLIENT_FIFO_NAME_MAX + 8];
+        client_fifo_path(c, path, sizeof(path));
+        control_printf("fifo: %s\n", path);
+    } else if (!strcmp(cmd, "pty") && argc == 2) {
+        struct vpty *p;
+        if ((p = vpty_open(argv[1])) == NULL) {
+            control_printf("error: pty '%s': %s\n", argv[1],
+                           errno == EINVAL ? "name must be made of letters, "
+                           "digits, - and _" : strerror(errno));
+            return -1;
+        }
+        char path[MY_PATH_MAX + VPTY_NAME_MAX + 8];
+        vpty_path(p, path, sizeof(path));
+        control_printf("pty: %s -> %s\n", path, vpty_tty(p));
+    } else if (!strcmp(cmd, "close") && argc == 2) {
+        struct client_fifo *c;
+        struct vpty *p;
+        if ((c = client_fifo_find(argv[1])) != NULL) {
+            client_fifo_close(c);
+        } else if ((p = vpty_find(argv[1])) != NULL) {
+            vpty_close(p);
+        } else {
+            control_printf("error: '%s': no such fifo or pty\n", argv[1]);
+            return -1;
+        }
+    } else if (!strcmp(cmd, "clients")) {
+        long long now = now_msec();
+        for (int i = 0; i < MAX_CLIENT_FIFOS; ++i) {
+            const struct client_fifo *c = &client_fifos[i];
+            if (c->fd == -1)
+                continue;
+            control_printf("%s: %lu message(s), %lu bytes, idle %lld s\n",
+                           c->name, c->messages, c->bytes,
+                           (now - c->last_activity) / 1000);
+        }
+        for (int i = 0; i < MAX_VPTYS; ++i) {
+            const struct vpty *p = &vptys[i];
+            if (p->master == -1)
+                continue;
+            control_printf("%s (pty %s): %lu message(s), %lu bytes, %lu "
+                           "line(s) written, %lu lost\n", p->name,
+                           vpty_tty(p), p->messages, p->bytes, p->lines,
+                           p->dropped);
+        }
+    } else if (!strcmp(cmd, "query") && argc >= 2) {
+        if (devread_fd() == -1) {
+            control_printf("error: device not read (option read_device, or "
+                           "device unavailable)\n");
+            return -1;
+        }
+        if (strlen(control_rest()) > QUERY_MAX) {
+            control_printf("error: query too long\n");
+            return -1;
+        }
+        return submit_query(control_rest());
+    } else if (!strcmp(cmd, "get") && (argc == 2 || argc == 3)) {
+        if (!cache_enabled()) {
+            control_printf("error: no cache (option cache_size)\n");
+            return -1;
+        }
+        value = cache_max_age;
+        if (argc == 3 && control_number(argv[2], &value))
+            return -1;
+        const char *line;
+        if ((line = cache_lookup(argv[1], value, now_msec())) != NULL) {
+            control_printf("%s\n", line);
+            return 0;
+        }
+            // Too old or unknown: ask the board
+        if (devread_fd() == -1) {
+            control_printf("error: no recent value, device not read\n");
+            return -1;
+        }
+        char query[QUERY_MAX + 1];
+        if (snprintf(query, sizeof(query), "%s%s%s", cache_query_prefix,
+                     argv[1], cache_query_suffix) >= (int)sizeof(query)) {
+            control_printf("error: key too long\n");
+            return -1;
+        }
+        return submit_query(query);
+    } else if (!strcmp(cmd, "subscribe") && argc == 3) {
+        if (!read_device) {
+            control_printf("error: device not read (option read_device)\n");
+            return -1;
+        }
+        if (strlen(argv[1]) > DEVREAD_KEY_MAX) {
+            control_printf("error: key too long\n");
+            return -1;
+        }
+        if (control_number(argv[2], &value))
+            return -1;
+        if (aggregate_add(control_client(), argv[1], value, now_msec())) {
+            control_printf("error: too many subscriptions\n");
+            return -1;
+        }
+    } else if (!strcmp(cmd, "unsubscribe") && argc == 2) {
+        if (aggregate_remove(control_client(), argv[1])) {
+            control_printf("error: '%s': not subscribed\n", argv[1]);
+            return -1;
+        }
+    } else if (!strcmp(cmd, "watch") && (argc == 2 || argc == 3)) {
+        if (!read_device) {
+            control_printf("error: device not read (option read_device)\n");
+            return -1;
+        }
+        enum pubsub_policy policy = PUBSUB_DROP;
+        if (argc == 3) {
+            if (!strcmp(argv[2], "disconnect")) {
+                policy = PUBSUB_DISCONNECT;
+            } else if (strcmp(argv[2], "drop")) {
+                control_printf("error: '%s': drop or disconnect expected\n",
+                               argv[2]);
+                return -1;
+            }
+        }
+        if (pubsub_watch(control_client(), argv[1], policy)) {
+            control_printf("error: %s\n", errno == EINVAL
+                           ? "DEVICE/PREFIX expected" : "too many patterns");
+            return -1;
+        }
+    } else if (!strcmp(cmd, "unwatch") && argc == 2) {
+        if (pubsub_unwatch(control_client(), argv[1])) {
+            control_printf("error: '%s': not watched\n", argv[1]);
+            return -1;
+        }
+    } else if (!strcmp(cmd, "set") && argc == 3) {
+        if (control_number(argv[2], &value))
+            return -1;
+        if (!strcmp(argv[1], "keepalive")) {
+            keepalive_while_success = value;
+        } else if (!strcmp(argv[1], "keepalive_failure")) {
+            keepalive_while_failure = value;
+        } else if (!strcmp(argv[1], "drain_batch")) {
+            drain_batch = value;
+        } else if (!strncmp(argv[1], "autotune_", 9)) {
+            if (!autotune_enabled()) {
+                control_printf("error: needs option autotune\n");
+                return -1;
+            }
+            if (!strcmp(argv[1], "autotune_latency")) {
+                autotune_latency = value;
+            } else if (!strcmp(argv[1], "autotune_rate_min")) {
+                autotune_rate_min = value;
+            } else if (!strcmp(argv[1], "autotune_rate_max")) {
+                autotune_rate_max = value;
+            } else if (!strcmp(argv[1], "autotune_batch_max")) {
+                autotune_batch_max = value;
+            } else {
+                control_printf("error: '%s': unknown setting\n", argv[1]);
+                return -1;
+            }
+            if (autotune_rate_min > autotune_rate_max)
+                autotune_rate_max = autotune_rate_min;
+            autotune_configure(autotune_latency, autotune_rate_min,
+                               autotune_rate_max, autotune_batch_max);
+        } else {
+            control_printf("error: '%s': unknown setting\n", argv[1]);
+            return -1;
+        }
+        keepalive_deadline =
+            now_msec() + keepalive_delay(last_write_buf_result);
+        l("control: %s set to %ld", argv[1], value);
+    } else {
+        control_printf("error: '%s': unknown command, try help\n", cmd);
+        return -1;
+    }
+    return 0;
+}
+
+    // Rounds deadline up to the next multiple of timer_slack.
+    // Timers due close to one another then fire within the same wakeup, and
+    // as the monotonic clock is shared, the wakeups of several instances of the
+    // daemon coincide, too.
+long long align_deadline(long long deadline) {
+    if (timer_slack <= 1)
+        return deadline;
+    return (deadline + timer_slack - 1) / timer_slack * timer_slack;
+}
+
+    // Metrics file needs to be written again only if something happened
+unsigned long metrics_activity() {
+    return metrics.messages + metrics.keepalives + metrics.write_errors
+        + queue_stats.replayed;
+}
+
+void count_wakeup(long long now) {
+    static long long minute_start = -1;
+    static unsigned long minute_wakeups = 0;
+
+    ++metrics.wakeups;
+    if (minute_start < 0)
+        minute_start = now;
+    if (now - minute_start >= 60000) {
+        metrics.wakeups_per_minute =
+            (now - minute_start < 120000 ? minute_wakeups : 0);
+        minute_start = now;
+        minute_wakeups = 0;
+    }
+    ++minute_wakeups;
+}
+
+    // Reads a message from fd and forwards it to the device.
+    // from is NULL for the main FIFO, the only one accepting EOF().
+    // Returns 1 if the daemon must quit.
+int receive(int fd, struct client_fifo *from) {
+    struct message *msg;
+    if ((msg = pool_alloc(&message_pool)) == NULL)
+        return 0;
+    char *buf = msg->buf;
+    char bufcopy[BUFSIZ];
+
+    profile_start();
+
+    ssize_t len;
+    if ((len = read(fd, buf, sizeof(msg->buf) - 1)) > 0) {
+        msg->len = len;
+        msg->received_at = now_usec();
+        buf[len] = '\0';
+
+        s_strncpy(bufcopy, buf, len);
+        remove_trailing_newline(bufcopy);
+        if (from)
+            l("received from %s: [%s]", from->name, bufcopy);
+        else
+            l("received: [%s]", bufcopy);
+        PROBE(received, device_index, len);
+        ++metrics.messages;
+        metrics.bytes_received += len;
+        stats_message(len);
+        if (from) {
+            ++from->messages;
+            from->bytes += len;
+            from->last_activity = now_msec();
+        }
+        profile_stage_end(STAGE_INGEST);
+
+        if (!from && !strncmp(buf, "EOF()", 5)) {
+            l("quitting");
+            pool_free(&message_pool, msg);
+            return 1;
+        }
+        unsigned long id;
+        if (from) {
+            forward(buf, len, msg->received_at,
+                    DISPATCH_SOURCE_FIFO(from - client_fifos), from->name, &id);
+        } else {
+            forward(buf, len, msg->received_at, DISPATCH_SOURCE_MAIN, "main",
+                    &id);
+        }
+    }
+    pool_free(&message_pool, msg);
+    return 0;
+}
+
+    // A line written by a tool to its pty (see vpty.h)
+void on_pty_message(struct vpty *p, char *buf, size_t len) {
+    char bufcopy[VPTY_FRAME_MAX + 1];
+    long long received_at = now_usec();
+
+    profile_start();
+    s_strncpy(bufcopy, buf, len);
+    remove_trailing_newline(bufcopy);
+    l("received from pty %s: [%s]", p->name, bufcopy);
+    PROBE(received, device_index, len);
+    ++metrics.messages;
+    metrics.bytes_received += len;
+    stats_message(len);
+    profile_stage_end(STAGE_INGEST);
+
+    unsigned long id;
+    forward(buf, len, received_at, DISPATCH_SOURCE_PTY(p - vptys), p->name,
+            &id);
+}
+
 void infinite_loop() {
-    int last_write_buf_result = -1;
+    keepalive_deadline = now_msec() + keepalive_delay(-1);
+    long long metrics_deadline = now_msec() + metrics_interval * 1000LL;
+    unsigned long metrics_written_activity = (unsigned long)-1;
+#ifdef FIXED_FOOTPRINT
+    int heap_allocs_reported = 0;
+#endif
     while (1) {
         fd_set rfds;
-        struct timeval tv;
+        fd_set wfds;
         int retval;
 
+            // Before fds get collected, as it closes those of idle FIFOs
+        long long fifo_expiry = client_fifo_expire(now_msec());
+
         FD_ZERO(&rfds);
         FD_SET(fifo_fd, &rfds);
-        tv.tv_sec = (last_write_buf_result == 0 ?
-                       KEEPALIVE_WHILE_SUCCESS :
-                       KEEPALIVE_WHILE_FAILURE);
-        tv.tv_usec = 0;
+        FD_ZERO(&wfds);
+        int max_fd = control_fds(&rfds, &wfds);
+        if (fifo_fd > max_fd)
+            max_fd = fifo_fd;
+        int client_max_fd = client_fifo_fds(&rfds);
+        if (client_max_fd > max_fd)
+            max_fd = client_max_fd;
+        int pty_max_fd = vpty_fds(&rfds);
+        if (pty_max_fd > max_fd)
+            max_fd = pty_max_fd;
+        if (devread_fd() != -1) {
+            FD_SET(devread_fd(), &rfds);
+            if (devread_fd() > max_fd)
+                max_fd = devread_fd();
+        }
 
-        retval = select(fifo_fd + 1, &rfds, NULL, NULL, &tv);
+        long long now = now_msec();
+        long long deadline = align_deadline(keepalive_deadline);
+            // When idle, the only timer left is the keepalive one
+        if (strlen(metrics_file_name)
+                && metrics_activity() != metrics_written_activity
+                && align_deadline(metrics_deadline) < deadline)
+            deadline = align_deadline(metrics_deadline);
+        if (fifo_expiry != -1 && align_deadline(fifo_expiry) < deadline)
+            deadline = align_deadline(fifo_expiry);
+            // Not aligned, a client waits, or expects a period
+        query_retry();
+        long long query_deadline = query_expire(now);
+        if (query_deadline != -1 && query_deadline < deadline)
+            deadline = query_deadline;
+        long long aggregate_deadline = aggregate_flush(now);
+        if (aggregate_deadline != -1 && aggregate_deadline < deadline)
+            deadline = aggregate_deadline;
+            // Not aligned, the rate would not be kept to
+        long long pace_deadline;
+        if (queue_waits() && (pace_deadline = autotune_ready_at(now)) != -1
+                && pace_deadline < deadline)
+            deadline = pace_deadline;
+        if (query_held() && (pace_deadline = autotune_ready_at(now)) != -1
+                && pace_deadline < deadline)
+            deadline = pace_deadline;
+        long long timeout = (deadline > now ? deadline - now : 0);
+        if (must_drain())
+            timeout = 0;
+            // For mapper-devusb-top, the file is only written if it changed
+        stats_queue(queue_stats.messages,
+                    queue_stats.memory_bytes + queue_stats.disk_bytes);
+
+        retval = busypoll_select(max_fd + 1, &rfds, &wfds, timeout);
 
         if (retval == -1) {
             l("error: select: %s", strerror(errno));
             continue;
-        } else if (retval == 0) {
+        }
+
+#ifdef FIXED_FOOTPRINT
+        if (heap_allocs_after_seal() && !heap_allocs_reported) {
+            l("error: heap allocation after initialization");
+            heap_allocs_reported = 1;
+        }
+#endif
+
+        now = now_msec();
+        count_wakeup(now);
+
+        if (now >= align_deadline(keepalive_deadline)) {
             if (log_keepalive == LOG_KEEPALIVE_ALWAYS) {
                 l("sending keepalive instruction (noop)");
             }
@@ -532,27 +1622,45 @@ void infinite_loop() {
             last_write_buf_result =
                 write_buf(KEEPALIVE_CMD, strlen(KEEPALIVE_CMD),
                           stay_silent_if_error);
-            continue;
+            on_write_buf_result(last_write_buf_result);
+            PROBE(keepalive, device_index, last_write_buf_result);
+            ++metrics.keepalives;
+            stats_keepalive();
+            keepalive_deadline = now + keepalive_delay(last_write_buf_result);
+            if (!last_write_buf_result)
+                open_device_for_reading();
         }
 
-        char buf[BUFSIZ];
-        char bufcopy[BUFSIZ];
+        if (strlen(metrics_file_name)
+                && metrics_activity() != metrics_written_activity
+                && now >= align_deadline(metrics_deadline)) {
+            slo_check(now_usec());
+            metrics_write(metrics_file_name);
+            metrics_written_activity = metrics_activity();
+            metrics_deadline = now + metrics_interval * 1000LL;
+        }
 
-        ssize_t len;
-        if ((len = read(fifo_fd, buf, sizeof(buf) - 1)) > 0) {
-            buf[len] = '\0';
+        if (must_drain()) {
+            last_write_buf_result = drain_queue();
+            keepalive_deadline =
+                now_msec() + keepalive_delay(last_write_buf_result);
+        }
 
-            s_strncpy(bufcopy, buf, len);
-            remove_trailing_newline(bufcopy);
-            l("received: [%s]", bufcopy);
+        if (retval == 0)
+            continue;
 
-            if (!strncmp(buf, "EOF()", 5)) {
-                l("quitting");
-                break;
-            } else {
-                last_write_buf_result = write_buf(buf, len, 0);
-            }
+        if (devread_fd() != -1 && FD_ISSET(devread_fd(), &rfds))
+            devread_handle();
+        control_handle(&rfds, &wfds);
+
+        if (FD_ISSET(fifo_fd, &rfds) && receive(fifo_fd, NULL))
+            break;
+        for (int i = 0; i < MAX_CLIENT_FIFOS; ++i) {
+            struct client_fifo *c = &client_fifos[i];
+            if (c->fd != -1 && FD_ISSET(c->fd, &rfds))
+                receive(c->fd, c);
         }
+        vpty_handle(&rfds);
     }
 
 }
@@ -565,6 +1673,11 @@ int main(int argc, char *argv[]) {
     s_strncpy(log_file_name, "", sizeof(log_file_name));
     s_strncpy(fifo_file_name, DEFAULT_FIFO_FILE_NAME, sizeof(fifo_file_name));
     s_strncpy(dev_file_name, "", sizeof(dev_file_name));
+    s_strncpy(metrics_file_name, "", sizeof(metrics_file_name));
+    s_strncpy(stats_dir, "", sizeof(stats_dir));
+    s_strncpy(spill_dir, "", sizeof(spill_dir));
+    s_strncpy(control_file_name, "", sizeof(control_file_name));
+    s_strncpy(series_dir, "", sizeof(series_dir));
 
         // Command-line options parsing is done in 2 rounds because reading the
         // config file can lead to error display (unknown option, missing config
@@ -595,6 +1708,7 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Try `mapper-devusb -h' for more information.\n");
         exit(1);
     }
+    device_index = device_number(dev_file_name);
 
     if (strlen(log_file_name)) {
         flog = fopen(log_file_name, "a");
@@ -609,7 +1723,7 @@ int main(int argc, char *argv[]) {
     l("start");
     DBG("config file:    [%s]", abs_cfgfile);
     DBG("debug on:       [%s]", (debug_on ? "yes" : "no"));
-    DBG("device file:    [%s]", dev_file_name);
+    DBG("device file:    [%s] (index %d)", dev_file_name, device_index);
     DBG("fifo file name: [%s]", fifo_file_name);
     if (log_file_name != NULL) {
         DBG("log file name:  [%s]", log_file_name);
@@ -617,6 +1731,23 @@ int main(int argc, char *argv[]) {
         DBG("log file name:  <stderr>");
     }
     DBG("daemon mode:    [%s]", run_as_a_daemon ? "yes" : "no");
+    DBG("metrics file:   [%s]", metrics_file_name);
+    DBG("profile:        [%s]", profile_on ? "yes" : "no");
+    DBG("stats dir:      [%s]", stats_dir);
+    DBG("timer slack:    [%lld ms]", timer_slack);
+    DBG("queue:          [%ld kB]", queue_memory);
+    DBG("spill dir:      [%s]", spill_dir);
+    DBG("autotune:       [%s, %ld ms, %ld to %ld bytes/s, batch %ld]",
+        autotune ? "yes" : "no", autotune_latency, autotune_rate_min,
+        autotune_rate_max, autotune_batch_max);
+    DBG("control:        [%s]", control_file_name);
+    DBG("read device:    [%s]", read_device ? "yes" : "no");
+    DBG("series dir:     [%s]", series_dir);
+    DBG("cpu:            [%d]", cpu);
+    DBG("busy poll:      [%ld us]", busy_poll);
+    DBG("worker:         [%s]", background_worker ? "yes" : "no");
+    DBG("slo:            [%ld ms for %.2f%% over %d s]", slo_latency,
+        slo_target, slo_window);
 
     if (access(fifo_file_name, R_OK ) != -1) {
         l("fifo '%s' already exists", fifo_file_name);
@@ -638,6 +1769,111 @@ int main(int argc, char *argv[]) {
 
     atexit(exit_handler);
 
+        // Counters are per-thread: open them once in the process that runs
+        // the loop (that is, after the daemon fork()s).
+    if (profile_on && !profile_open())
+        l("warning: profile: no counter available");
+
+    if (strlen(stats_dir))
+        stats_open(stats_dir, dev_file_name);
+    if (strlen(series_dir)) {
+        if (!read_device)
+            l("warning: series_dir: device not read (option read_device)");
+        else
+            series_open(series_dir, dev_file_name, series_chunk);
+    }
+
+        // One daemon per device: pinning them to distinct CPUs spreads a
+        // fleet over the cores, each daemon keeping its caches warm.
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set))
+            l("warning: cannot pin to cpu %d: %s", cpu, strerror(errno));
+    }
+
+    if (busy_poll) {
+        l("busy poll: fds polled for %ld us before sleeping", busy_poll);
+        if (cpu < 0)
+            l("warning: busy_poll: daemon not pinned to a cpu (option cpu)");
+        if (busypoll_init(busy_poll))
+            l("warning: busy_poll: cannot set timer slack: %s",
+              strerror(errno));
+    }
+
+        // Started after the daemon fork()s, as threads do not survive it
+    if (background_worker && strlen(metrics_file_name) && worker_start())
+        l("warning: cannot start background worker: %s", strerror(errno));
+
+    if (queue_memory
+            && queue_init(queue_memory * 1024, spill_dir, dev_file_name)) {
+        l("error: cannot allocate queue: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    dispatch_init(queue_stats.messages);
+    if (autotune && !queue_memory) {
+        l("warning: autotune: writes not paced, needs option queue_memory");
+    } else if (autotune) {
+            // A byte takes 10 bits on the line (start and stop bits)
+        if (!autotune_rate_max)
+            autotune_rate_max = SERIAL_SPEED_INTEGER / 10;
+        if (autotune_rate_min > autotune_rate_max)
+            autotune_rate_max = autotune_rate_min;
+        autotune_init(SERIAL_SPEED_INTEGER / 10);
+        autotune_configure(autotune_latency, autotune_rate_min,
+                           autotune_rate_max, autotune_batch_max);
+    }
+
+    if (strlen(control_file_name)
+            && control_open(control_file_name, control_command)) {
+        l("error: cannot open control socket '%s': %s", control_file_name,
+          strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+        // Client FIFOs go next to the control socket
+    char client_fifo_dir[MY_PATH_MAX];
+    s_strncpy(client_fifo_dir, control_file_name, sizeof(client_fifo_dir));
+    char *slash = strrchr(client_fifo_dir, '/');
+    if (slash)
+        *slash = '\0';
+    else
+        s_strncpy(client_fifo_dir, ".", sizeof(client_fifo_dir));
+    client_fifo_init(client_fifo_dir, client_fifo_idle);
+    vpty_init(client_fifo_dir, on_pty_message);
+
+    snprintf(separators, sizeof(separators), " \t%s", field_separators);
+    const char *dev_base = strrchr(dev_file_name, '/');
+    pubsub_init(dev_base ? dev_base + 1 : dev_file_name);
+    query_init(query_timeout, write_query);
+    if (dedup_memory && dedup_init(dedup_memory * 1024,
+                                   dedup_window * 1000LL)) {
+        l("error: cannot allocate idempotency keys: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (cache_size && cache_init(cache_size)) {
+        l("error: cannot allocate cache: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    open_device_for_reading();
+
+    if (slo_latency)
+        slo_init(slo_latency, slo_target, slo_window);
+
+    if (pool_init(&message_pool, "message", sizeof(struct message),
+                  MESSAGE_POOL_SIZE)) {
+        l("error: cannot allocate message pool: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    l("footprint: message pool %lu kB (%d x %lu bytes), resident size %lu kB",
+      (unsigned long)pool_footprint(&message_pool) / 1024, MESSAGE_POOL_SIZE,
+      (unsigned long)message_pool.block_size,
+      (unsigned long)resident_size() / 1024);
+#ifdef FIXED_FOOTPRINT
+        // From now on, heap allocations are errors
+    heap_seal();
+#endif
+
 #ifdef HAVE_SYSTEMD
     sd_notify(0, "READY=1");
 #endif
@@ -0,0 +1,223 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * metrics.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <linux/limits.h>
+
+#include "util.h"
+#include "metrics.h"
+#include "profile.h"
+#include "slo.h"
+#include "pool.h"
+#include "worker.h"
+#include "queue.h"
+#include "client_fifo.h"
+#include "query.h"
+#include "cache.h"
+#include "aggregate.h"
+#include "series.h"
+#include "pubsub.h"
+#include "dedup.h"
+#include "dispatch.h"
+#include "autotune.h"
+#include "busypoll.h"
+#include "vpty.h"
+
+struct metrics metrics;
+
+extern struct pool message_pool;
+
+    // Metrics are formatted here then written at once. No stdio, as fopen()
+    // allocates.
+static char out[16384];
+static size_t out_len;
+
+void metrics_printf(const char *fmt, ...) {
+    if (out_len >= sizeof(out))
+        return;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(out + out_len, sizeof(out) - out_len, fmt, args);
+    va_end(args);
+    if (n > 0)
+        out_len += n;
+}
+
+static void write_metric(const char *name, const char *type, const char *help,
+        unsigned long value) {
+    metrics_printf("# HELP mapper_devusb_%s %s\n", name, help);
+    metrics_printf("# TYPE mapper_devusb_%s %s\n", name, type);
+    metrics_printf("mapper_devusb_%s %lu\n", name, value);
+}
+
+    // What the worker writes, while the loop formats the next metrics in out
+static char pending[sizeof(out)];
+static size_t pending_len;
+static char pending_file_name[PATH_MAX];
+    // 1 while the worker writes pending
+static atomic_int writing = 0;
+    // errno of the last write done by the worker, -1 when reported already
+static atomic_int write_result = -1;
+
+static int write_file(const char *file_name, const char *buf, size_t len) {
+    int fd;
+    if ((fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+        return -1;
+    ssize_t n = write(fd, buf, len);
+    if (n != (ssize_t)len) {
+        if (n != -1)
+            errno = EIO;
+        close(fd);
+        return -1;
+    }
+    return close(fd);
+}
+
+    // Returns 0 on success, errno otherwise
+static int replace_file(const char *file_name, const char *buf, size_t len) {
+    char tmp_file_name[PATH_MAX + 8];
+    snprintf(tmp_file_name, sizeof(tmp_file_name), "%s.tmp", file_name);
+
+    if (write_file(tmp_file_name, buf, len) || rename(tmp_file_name,
+                                                      file_name)) {
+        int err = errno;
+        unlink(tmp_file_name);
+        return err;
+    }
+    return 0;
+}
+
+    // Logs failures, and recovery, once
+static void report(const char *file_name, int err) {
+    static int last_write_failed = 0;
+
+    if (err) {
+        if (!last_write_failed)
+            l("error: cannot write '%s': %s", file_name, strerror(err));
+        last_write_failed = 1;
+    } else {
+        if (last_write_failed)
+            l("metrics file '%s' written again", file_name);
+        last_write_failed = 0;
+    }
+}
+
+    // Runs in the worker
+static void write_pending(void *unused) {
+    (void)unused;
+    atomic_store(&write_result,
+                 replace_file(pending_file_name, pending, pending_len));
+    atomic_store(&writing, 0);
+}
+
+void metrics_write(const char *file_name) {
+    int err;
+    if ((err = atomic_exchange(&write_result, -1)) != -1)
+        report(file_name, err);
+
+    out_len = 0;
+    write_metric("messages_total", "counter", "Messages received on the FIFO",
+                 metrics.messages);
+    write_metric("received_bytes_total", "counter",
+                 "Bytes received on the FIFO", metrics.bytes_received);
+    write_metric("written_bytes_total", "counter",
+                 "Bytes written to the device", metrics.bytes_written);
+    write_metric("write_errors_total", "counter", "Failed device writes",
+                 metrics.write_errors);
+    write_metric("keepalives_total", "counter", "Keepalive instructions sent",
+                 metrics.keepalives);
+    write_metric("wakeups_total", "counter", "Event loop wakeups",
+                 metrics.wakeups);
+    write_metric("wakeups_per_minute", "gauge",
+                 "Event loop wakeups during the last complete minute",
+                 metrics.wakeups_per_minute);
+    write_metric("resident_bytes", "gauge", "Resident set size",
+                 resident_size());
+    write_metric("message_pool_bytes", "gauge", "Memory of the message pool",
+                 pool_footprint(&message_pool));
+    write_metric("message_pool_exhausted_total", "counter",
+                 "Messages the pool could not serve from its blocks",
+                 message_pool.nb_exhausted);
+    if (queue_enabled()) {
+        write_metric("queue_messages", "gauge",
+                     "Messages waiting for the device", queue_stats.messages);
+        write_metric("queue_memory_bytes", "gauge",
+                     "Bytes of queued messages in memory",
+                     queue_stats.memory_bytes);
+        write_metric("queue_disk_bytes", "gauge",
+                     "Bytes of queued messages in spill files",
+                     queue_stats.disk_bytes);
+        write_metric("queue_spilled_total", "counter",
+                     "Messages queued in spill files", queue_stats.spilled);
+        write_metric("queue_replayed_total", "counter",
+                     "Queued messages written to the device",
+                     queue_stats.replayed);
+        write_metric("queue_dropped_total", "counter",
+                     "Messages lost, queue full", queue_stats.dropped);
+    }
+#ifdef FIXED_FOOTPRINT
+    write_metric("heap_allocations_after_init_total", "counter",
+                 "Heap allocations done after initialization",
+                 heap_allocs_after_seal());
+#endif
+    profile_write_metrics();
+    slo_write_metrics();
+    client_fifo_write_metrics();
+    query_write_metrics();
+    cache_write_metrics();
+    aggregate_write_metrics();
+    series_write_metrics();
+    pubsub_write_metrics();
+    dedup_write_metrics();
+    dispatch_write_metrics();
+    autotune_write_metrics();
+    busypoll_write_metrics();
+    vpty_write_metrics();
+
+    if (out_len >= sizeof(out)) {
+        report(file_name, ENOBUFS);
+        return;
+    }
+
+    if (worker_running()) {
+            // Previous write not done yet (slow disk): skip this one
+        if (atomic_load(&writing))
+            return;
+        memcpy(pending, out, out_len);
+        pending_len = out_len;
+        s_strncpy(pending_file_name, file_name, sizeof(pending_file_name));
+        atomic_store(&writing, 1);
+        if (!worker_submit(write_pending, NULL))
+            return;
+        atomic_store(&writing, 0);
+    }
+    report(file_name, replace_file(file_name, out, out_len));
+}
@@ -0,0 +1,50 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * metrics.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+    // Counters exported in the metrics file
+struct metrics {
+    unsigned long messages;         // FIFO reads forwarded to the device
+    unsigned long bytes_received;
+    unsigned long bytes_written;
+    unsigned long write_errors;
+    unsigned long keepalives;
+    unsigned long wakeups;          // Returns from select()
+    unsigned long wakeups_per_minute;   // Over the last complete minute
+};
+
+extern struct metrics metrics;
+
+    // Writes all metrics to file_name, in Prometheus text format.
+    // The file is replaced atomically.
+void metrics_write(const char *file_name);
+
+    // For modules to add their own metrics, while metrics_write() runs
+void metrics_printf(const char *fmt, ...)
+     __attribute__((format(printf, 1, 2)));
+
+#endif // METRICS_H
@@ -0,0 +1,489 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * microbench.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Micro-benchmarks of mapper-devusb hot-path functions.
+ *
+ * Prints for each function the time (ns/op) and the number of heap
+ * allocations (allocs/op) one call costs, in the format of
+ * microbench-baseline.txt.
+ *
+ * Modules are linked as they are, but for control.c and metrics.c, which have
+ * stand-ins below.
+ *
+ * With -c FILE, compares with FILE instead and exits with status 1 if a
+ * function got slower by more than the tolerance, or allocates more. A
+ * slow-down of a few nanoseconds (the floor) is not one: at that scale, it
+ * is noise, whatever its percentage.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+#include "pool.h"
+#include "queue.h"
+#include "control.h"
+#include "metrics.h"
+#include "pubsub.h"
+#include "vpty.h"
+#include "devread.h"
+#include "query.h"
+#include "dedup.h"
+
+#define DEFAULT_TOLERANCE_PCT 20
+#define DEFAULT_FLOOR_NS 5
+#define TARGET_NSEC 200000000LL
+#define RUNS 3
+
+#ifdef FIXED_FOOTPRINT
+
+    // pool.c interposes glibc allocator already
+#define NB_ALLOCS() heap_allocs_after_seal()
+
+#else
+
+    // Heap allocations counter, see malloc() & co below
+static unsigned long nb_allocs = 0;
+#define NB_ALLOCS() nb_allocs
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+    // Interpose glibc allocator, to count allocations done by the benchmarked
+    // code and by the libc functions it calls.
+void *malloc(size_t size) {
+    ++nb_allocs;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    ++nb_allocs;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    ++nb_allocs;
+    return __libc_realloc(ptr, size);
+}
+
+#endif // FIXED_FOOTPRINT
+
+    // What control.c would send, formatted but not sent
+static char out[1024];
+
+    // Stand-ins for control.c: clients are always connected, and there is
+    // always room in their output buffer.
+int control_alive(int client) {
+    (void)client;
+    return 1;
+}
+
+void control_disconnect(int client) {
+    (void)client;
+}
+
+int control_push(int client, const char *fmt, ...) {
+    (void)client;
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(out, sizeof(out), fmt, args);
+    va_end(args);
+    return 0;
+}
+
+void control_reply(int client, const char *fmt, ...) {
+    (void)client;
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(out, sizeof(out), fmt, args);
+    va_end(args);
+}
+
+    // Stand-in for metrics.c, that links with every module
+void metrics_printf(const char *fmt, ...) {
+    (void)fmt;
+}
+
+    // Typical instruction sent through the FIFO
+static const char *CMD = "led 3 255 128 0 fade 1500\n";
+
+static char buf[BUFSIZ];
+static char bufcopy[BUFSIZ];
+static size_t cmd_len;
+
+static void bench_output_datetime_of_day() {
+    output_datetime_of_day(flog);
+}
+
+static void bench_l() {
+    l("received: [%s]", bufcopy);
+}
+
+static void bench_s_strncpy() {
+    s_strncpy(bufcopy, buf, cmd_len);
+}
+
+static void bench_remove_trailing_newline() {
+    memcpy(bufcopy, CMD, cmd_len + 1);
+    remove_trailing_newline(bufcopy);
+}
+
+static void bench_trim() {
+    char tmp[64];
+    strcpy(tmp, "  device = /dev/ttyUSB0\t ");
+    trim(tmp);
+}
+
+    // What infinite_loop() does with every FIFO read, up to the device write
+static void bench_receive() {
+    memcpy(buf, CMD, cmd_len + 1);
+    s_strncpy(bufcopy, buf, cmd_len);
+    remove_trailing_newline(bufcopy);
+    l("received: [%s]", bufcopy);
+}
+
+static struct pool pool;
+
+static void bench_pool_alloc_free() {
+    pool_free(&pool, pool_alloc(&pool));
+}
+
+    // A message queued while the device is away, then written
+static void bench_queue_push_pop() {
+    long long received_at;
+    queue_push(CMD, cmd_len, 0);
+    queue_peek(bufcopy, sizeof(bufcopy), &received_at);
+    queue_pop();
+}
+
+    // Typical line printed by the board
+static const char *LINE = "temp: 21.5";
+
+    // A line read from the device, against the patterns of a few watchers,
+    // three of which match
+static void bench_pubsub_publish() {
+    pubsub_publish(LINE, strlen(LINE));
+}
+
+static struct vpty *pty;
+
+static void on_pty_message(struct vpty *p, char *msg, size_t len) {
+    (void)p;
+    (void)msg;
+    (void)len;
+}
+
+    // What a tool writes to its pty, framed in a message
+static void bench_vpty_feed() {
+    vpty_feed(pty, CMD, cmd_len);
+}
+
+    // What one read of the device typically returns
+static const char *BOARD_OUTPUT = "temp: 21.5\r\nhum: 40\r\nlight: 312\r\n";
+
+static void on_device_line(const char *line, size_t len) {
+    (void)line;
+    (void)len;
+}
+
+static void bench_devread_feed() {
+    devread_feed(BOARD_OUTPUT, strlen(BOARD_OUTPUT));
+}
+
+static int send_query(const char *query, size_t len) {
+    (void)query;
+    (void)len;
+    return 0;
+}
+
+    // Two clients asking the same: the second query is collapsed onto the
+    // first, sent, then answered to both
+static void bench_query_submit() {
+    query_submit("temp?", 1);
+    query_submit("temp?", 2);
+    query_response(LINE, strlen(LINE));
+}
+
+    // More than the table holds, so that every key is new when it comes back
+#define NB_KEYS 4096
+static char keys[NB_KEYS][8];
+static unsigned nb_key = 0;
+
+    // A message with an idempotency key, checked then remembered, the oldest
+    // key being evicted
+static void bench_dedup_seen_add() {
+    const char *key = keys[nb_key++ % NB_KEYS];
+    if (!dedup_seen(key, 5, 0))
+        dedup_add(key, 5, 0);
+}
+
+struct bench {
+    const char *name;
+    void (*func)();
+    int log_usec;
+};
+
+static const struct bench benches[] = {
+    { "output_datetime_of_day", bench_output_datetime_of_day, 0 },
+    { "output_datetime_of_day_usec", bench_output_datetime_of_day, 1 },
+    { "l", bench_l, 0 },
+    { "s_strncpy", bench_s_strncpy, 0 },
+    { "remove_trailing_newline", bench_remove_trailing_newline, 0 },
+    { "trim", bench_trim, 0 },
+    { "receive", bench_receive, 1 },
+    { "pool_alloc_free", bench_pool_alloc_free, 0 },
+    { "queue_push_pop", bench_queue_push_pop, 0 },
+    { "pubsub_publish", bench_pubsub_publish, 0 },
+    { "vpty_feed", bench_vpty_feed, 0 },
+    { "devread_feed", bench_devread_feed, 0 },
+    { "query_submit", bench_query_submit, 0 },
+    { "dedup_seen_add", bench_dedup_seen_add, 0 }
+};
+#define NB_BENCHES (sizeof(benches) / sizeof(*benches))
+
+struct result {
+    double ns_per_op;
+    double allocs_per_op;
+};
+
+static long long now_nsec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long long run(const struct bench *b, unsigned long iterations) {
+    long long t0 = now_nsec();
+    for (unsigned long i = 0; i < iterations; ++i)
+        b->func();
+    return now_nsec() - t0;
+}
+
+    // Calibrates the number of iterations to last about TARGET_NSEC, then keeps
+    // the best of RUNS runs.
+static struct result measure(const struct bench *b) {
+    log_usec = b->log_usec;
+
+    unsigned long iterations = 1;
+    long long t;
+    while ((t = run(b, iterations)) < TARGET_NSEC / 10
+            && iterations < 1UL << 30)
+        iterations *= 2;
+    iterations = (double)iterations * TARGET_NSEC / (t + 1) + 1;
+
+    struct result r;
+    r.ns_per_op = -1;
+    for (int i = 0; i < RUNS; ++i) {
+        unsigned long allocs_before = NB_ALLOCS();
+        t = run(b, iterations);
+        double ns = (double)t / iterations;
+        if (r.ns_per_op < 0 || ns < r.ns_per_op)
+            r.ns_per_op = ns;
+        r.allocs_per_op = (double)(NB_ALLOCS() - allocs_before) / iterations;
+    }
+    return r;
+}
+
+static int compare(const char *file_name, double tolerance_pct,
+        double floor_ns, struct result *results) {
+    FILE *f;
+    if ((f = fopen(file_name, "r")) == NULL) {
+        fprintf(stderr, "%s: error: unable to open for reading\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+
+    int regressions = 0;
+    char line[256];
+    printf("%-30s %12s %12s %8s %10s\n", "function", "base ns/op",
+           "ns/op", "delta", "allocs/op");
+    while (fgets(line, sizeof(line), f)) {
+        char name[64];
+        double base_ns;
+        double base_allocs;
+        if (line[0] == '#'
+                || sscanf(line, "%63s %lf %lf", name, &base_ns,
+                          &base_allocs) != 3)
+            continue;
+
+        size_t i;
+        for (i = 0; i < NB_BENCHES; ++i) {
+            if (!strcmp(benches[i].name, name))
+                break;
+        }
+        if (i == NB_BENCHES) {
+            printf("%-30s (no longer benchmarked)\n", name);
+            continue;
+        }
+
+        const struct result *r = &results[i];
+        double delta = (r->ns_per_op - base_ns) * 100 / base_ns;
+        const char *verdict = "";
+        if ((delta > tolerance_pct && r->ns_per_op - base_ns > floor_ns)
+                || r->allocs_per_op > base_allocs + 0.005) {
+            verdict = "  REGRESSION";
+            ++regressions;
+        }
+        printf("%-30s %12.1f %12.1f %+7.1f%% %10.2f%s\n", name, base_ns,
+               r->ns_per_op, delta, r->allocs_per_op, verdict);
+    }
+    fclose(f);
+
+    return regressions;
+}
+
+void usage() {
+    printf("Usage:\n\
+  microbench [OPTIONS]\n\
+Measures mapper-devusb hot-path functions.\n\
+\n\
+  -h       Print this help screen\n\
+  -c FILE  Compare with baseline FILE (typically microbench-baseline.txt)\n\
+  -t PCT   Slow-down tolerated by -c, in percent, default: %d\n\
+  -f NS    Slow-down tolerated by -c whatever its percentage, in ns/op,\n\
+           default: %d\n",
+           DEFAULT_TOLERANCE_PCT, DEFAULT_FLOOR_NS);
+}
+
+int main(int argc, char *argv[]) {
+    const char *baseline = NULL;
+    double tolerance_pct = DEFAULT_TOLERANCE_PCT;
+    double floor_ns = DEFAULT_FLOOR_NS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hc:t:f:")) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            exit(0);
+        case 'c':
+            baseline = optarg;
+            break;
+        case 't':
+            tolerance_pct = atof(optarg);
+            break;
+        case 'f':
+            floor_ns = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "Try `microbench -h' for more information.\n");
+            exit(1);
+        }
+    }
+
+        // Same as the daemon with a log file
+    if ((flog = fopen("/dev/null", "a")) == NULL) {
+        fprintf(stderr, "/dev/null: error: unable to open for writing\n");
+        exit(EXIT_FAILURE);
+    }
+    setvbuf(flog, NULL, _IONBF, 0);
+
+    cmd_len = strlen(CMD);
+    memcpy(buf, CMD, cmd_len + 1);
+    s_strncpy(bufcopy, CMD, sizeof(bufcopy));
+    remove_trailing_newline(bufcopy);
+
+    if (pool_init(&pool, "bench", BUFSIZ, 4)) {
+        fprintf(stderr, "error: cannot allocate pool\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (queue_init(65536, "", "bench")) {
+        fprintf(stderr, "error: cannot allocate queue\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pubsub_init("bench");
+    static const char *patterns[] = {
+        "bench/temp", "bench/hum", "bench/", "other/temp", "bench/pressure",
+        "bench/t", "bench/light", "bench/error"
+    };
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(*patterns); ++i)
+        pubsub_watch(i, patterns[i], PUBSUB_DROP);
+
+    char pty_dir[] = "/tmp/microbench.XXXXXX";
+    if (!mkdtemp(pty_dir)) {
+        fprintf(stderr, "error: cannot create directory: %s\n",
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    vpty_init(pty_dir, on_pty_message);
+    if ((pty = vpty_open("bench")) == NULL) {
+        fprintf(stderr, "error: cannot create pty: %s\n", strerror(errno));
+        rmdir(pty_dir);
+        exit(EXIT_FAILURE);
+    }
+        // The device, as seen from the board, is the pty
+    if (devread_open(vpty_tty(pty), on_device_line)) {
+        fprintf(stderr, "error: cannot open pty: %s\n", strerror(errno));
+        vpty_close_all();
+        rmdir(pty_dir);
+        exit(EXIT_FAILURE);
+    }
+
+    query_init(1000, send_query);
+
+        // dedup_memory = 64 (kB), as in the example configuration: about
+        // 2300 keys
+    if (dedup_init(65536, 600000)) {
+        fprintf(stderr, "error: cannot allocate dedup table\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < NB_KEYS; ++i)
+        snprintf(keys[i], sizeof(keys[i]), "k%04d", i);
+
+#ifdef FIXED_FOOTPRINT
+    heap_seal();
+#endif
+
+    struct result results[NB_BENCHES];
+    for (size_t i = 0; i < NB_BENCHES; ++i)
+        results[i] = measure(&benches[i]);
+
+    int status = 0;
+    if (baseline) {
+        if (compare(baseline, tolerance_pct, floor_ns, results))
+            status = 1;
+    } else {
+        printf("%-30s %9s %10s\n", "# function", "ns/op", "allocs/op");
+        for (size_t i = 0; i < NB_BENCHES; ++i) {
+            printf("%-30s %9.1f %10.2f\n", benches[i].name,
+                   results[i].ns_per_op, results[i].allocs_per_op);
+        }
+    }
+
+    devread_close();
+    vpty_close_all();
+    rmdir(pty_dir);
+    fclose(flog);
+
+    return status;
+}
@@ -0,0 +1,75 @@
+#!/bin/sh
+
+#
+# Copyright 2026 Sébastien Millet
+#
+
+# Checks that the pacing of autotune keeps to its rate: devsim (pty standing in
+# for the Arduino board) sends a burst of COUNT commands through the FIFO, that
+# mapper-devusb of BUILD_DIR writes at autotune_rate_max = RATE bytes per
+# second. All of them must reach the device, once, within the time the rate
+# gives plus half of it.
+#
+# Runs twice: with the queue in memory, then with a ring of the smallest size
+# (queue_memory = 1), overflowing to a spill directory, with five times as many
+# commands five times as fast.
+#
+# Prints for each run the commands sent, received and duplicated and the time
+# allowed, exits with status 1 if some did not arrive in time or arrived
+# twice.
+#
+# Usage:
+#   ./pace-check.sh BUILD_DIR [COUNT [RATE]]
+
+set -eu
+
+BUILD=$1
+COUNT=${2:-100}
+RATE=${3:-400}
+
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+status=0
+
+    # Arguments: name, number of commands, rate, extra configuration line
+run() {
+    rm -f "$WORKDIR/fifo"
+    mkfifo "$WORKDIR/fifo"
+    cat > "$WORKDIR/conf" <<CONF
+log_usec = yes
+autotune = yes
+autotune_rate_min = $3
+autotune_rate_max = $3
+$4
+CONF
+
+    "$BUILD/mapper-devusb" -c "$WORKDIR/conf" -f "$WORKDIR/fifo" \
+        -l "$WORKDIR/log" "$WORKDIR/tty" &
+    pid=$!
+
+        # devsim commands are "bench NNNNNN\n", 13 bytes. They are sent
+        # within 100 ms.
+    allowed_ms=$(($2 * 13 * 1000 / $3 * 3 / 2))
+    "$BUILD/devsim" -f "$WORKDIR/fifo" -r $(($2 * 10)) -t 100 \
+        -g "$allowed_ms" "$WORKDIR/tty" > "$WORKDIR/report"
+
+    echo "EOF()" > "$WORKDIR/fifo"
+    wait $pid || true
+
+        # total: sent N, received N, lost N, duplicated N, ...
+    set -- "$1" $(awk -F '[ ,]+' '/^total:/ { print $3, $5, $9 }' \
+        "$WORKDIR/report")
+    echo "$1: sent $2, received $3, duplicated $4, within $allowed_ms ms"
+    if [ "$3" -lt "$2" ] || [ "$4" -ne 0 ]; then
+        status=1
+    fi
+}
+
+run memory "$COUNT" "$RATE" "queue_memory = 64"
+mkdir "$WORKDIR/spill"
+run spill $((COUNT * 5)) $((RATE * 5)) \
+    "queue_memory = 1
+spill_dir = $WORKDIR/spill"
+
+exit $status
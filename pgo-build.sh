@@ -0,0 +1,84 @@
+#!/bin/sh
+
+#
+# Copyright 2026 Sébastien Millet
+#
+
+# Builds mapper-devusb with link-time and profile-guided optimizations, the
+# profile being collected with workload.sh, then compares it with the plain
+# build.
+#
+# Usage:
+#   ./pgo-build.sh [OUTPUT_DIR]
+#
+# In OUTPUT_DIR (default: pgo):
+#   plain/       plain build
+#   opt/         optimized build
+#   profile/     profile data, see --with-pgo-dir option of configure
+#   report.txt   comparison
+#
+# Configure options can be passed with CONFIGURE_FLAGS, for example:
+#   CONFIGURE_FLAGS=--without-systemdsystemunitdir ./pgo-build.sh
+
+set -eu
+
+SRC=$(cd "$(dirname "$0")" && pwd)
+OUT=${1:-pgo}
+CONFIGURE_FLAGS=${CONFIGURE_FLAGS:-}
+TRAIN_DURATION=${TRAIN_DURATION:-20000}
+BENCH_DURATION=${BENCH_DURATION:-10000}
+RUNS=${RUNS:-3}
+
+mkdir -p "$OUT/plain" "$OUT/opt"
+OUT=$(cd "$OUT" && pwd)
+PROFILE="$OUT/profile"
+
+echo "== plain build"
+(cd "$OUT/plain" && "$SRC/configure" $CONFIGURE_FLAGS > configure.log && \
+    make > make.log)
+
+echo "== instrumented build, training"
+rm -rf "$PROFILE"
+(cd "$OUT/opt" && "$SRC/configure" $CONFIGURE_FLAGS --enable-lto \
+    --enable-pgo=generate --with-pgo-dir="$PROFILE" > configure.log && \
+    make clean > /dev/null && make > make.log)
+"$SRC/workload.sh" "$OUT/opt" "$TRAIN_DURATION" > /dev/null
+
+echo "== optimized build"
+(cd "$OUT/opt" && "$SRC/configure" $CONFIGURE_FLAGS --enable-lto \
+    --enable-pgo=use --with-pgo-dir="$PROFILE" > configure.log && \
+    make clean > /dev/null && make > make.log)
+
+    # Keeps the run with the lowest CPU time per command
+best() {
+    build=$1
+    best_ratio=
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        set -- $("$SRC/workload.sh" "$build" "$BENCH_DURATION")
+        ratio=$(awk -v n="$1" -v cpu="$2" \
+            'BEGIN { printf "%.2f", cpu * 1000 / n }')
+        if [ -z "$best_ratio" ] || awk -v a="$ratio" -v b="$best_ratio" \
+                'BEGIN { exit !(a < b) }'; then
+            best_ratio=$ratio
+        fi
+        i=$((i + 1))
+    done
+    echo "$best_ratio"
+}
+
+echo "== benchmark"
+plain=$(best "$OUT/plain")
+opt=$(best "$OUT/opt")
+"$OUT/plain/microbench" > "$OUT/plain.microbench"
+
+{
+    echo "Daemon CPU time per command (usec), best of $RUNS runs:"
+    echo "  plain      $plain"
+    echo "  lto + pgo  $opt"
+    awk -v a="$plain" -v b="$opt" \
+        'BEGIN { printf "  gain       %.1f%%\n", (a - b) * 100 / a }'
+    echo
+    echo "Hot-path functions, lto + pgo compared with plain:"
+    "$OUT/opt/microbench" -c "$OUT/plain.microbench" -t 1000 || true
+} | tee "$OUT/report.txt"
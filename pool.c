@@ -0,0 +1,156 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * pool.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "pool.h"
+
+    // Blocks are chained through their first bytes while free
+struct free_block {
+    struct free_block *next;
+};
+
+int pool_init(struct pool *p, const char *name, size_t block_size,
+        size_t nb_blocks) {
+    p->name = name;
+    if (block_size < sizeof(struct free_block))
+        block_size = sizeof(struct free_block);
+        // Keep blocks aligned for any type
+    block_size = (block_size + sizeof(long long) - 1)
+                 & ~(sizeof(long long) - 1);
+    p->block_size = block_size;
+    p->nb_blocks = 0;
+    p->nb_free = 0;
+    p->free_list = NULL;
+    p->nb_exhausted = 0;
+
+    if (!nb_blocks)
+        return 0;
+
+    char *chunk;
+    if ((chunk = malloc(block_size * nb_blocks)) == NULL)
+        return -1;
+        // Touch every page now, for the resident size to be final
+    memset(chunk, 0, block_size * nb_blocks);
+
+    for (size_t i = 0; i < nb_blocks; ++i)
+        pool_free(p, chunk + i * block_size);
+    p->nb_blocks = nb_blocks;
+
+    return 0;
+}
+
+void *pool_alloc(struct pool *p) {
+    struct free_block *b = p->free_list;
+    if (b) {
+        p->free_list = b->next;
+        --p->nb_free;
+        return b;
+    }
+
+    ++p->nb_exhausted;
+#ifdef FIXED_FOOTPRINT
+    return NULL;
+#else
+    if ((b = malloc(p->block_size)) != NULL)
+        ++p->nb_blocks;
+    return b;
+#endif
+}
+
+void pool_free(struct pool *p, void *block) {
+    struct free_block *b = block;
+    b->next = p->free_list;
+    p->free_list = b;
+    ++p->nb_free;
+}
+
+size_t pool_footprint(const struct pool *p) {
+    return p->block_size * p->nb_blocks;
+}
+
+size_t resident_size() {
+        // No stdio here: fopen() allocates.
+    int fd;
+    if ((fd = open("/proc/self/statm", O_RDONLY)) == -1)
+        return 0;
+    char buf[128];
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return 0;
+    buf[n] = '\0';
+
+        // Second field: resident pages
+    char *p = strchr(buf, ' ');
+    if (!p)
+        return 0;
+    return strtoul(p + 1, NULL, 10) * sysconf(_SC_PAGESIZE);
+}
+
+#ifdef FIXED_FOOTPRINT
+
+static int sealed = 0;
+static unsigned long nb_heap_allocs = 0;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+    // Atomic, the metrics worker thread allocates too
+static void count_alloc() {
+    if (__atomic_load_n(&sealed, __ATOMIC_RELAXED))
+        __atomic_add_fetch(&nb_heap_allocs, 1, __ATOMIC_RELAXED);
+}
+
+    // Interpose glibc allocator, to count allocations done once the
+    // initialization is over, including the ones done inside the libc.
+void *malloc(size_t size) {
+    count_alloc();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    count_alloc();
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    count_alloc();
+    return __libc_realloc(ptr, size);
+}
+
+void heap_seal() {
+    __atomic_store_n(&sealed, 1, __ATOMIC_RELAXED);
+}
+
+unsigned long heap_allocs_after_seal() {
+    return __atomic_load_n(&nb_heap_allocs, __ATOMIC_RELAXED);
+}
+
+#endif // FIXED_FOOTPRINT
@@ -0,0 +1,66 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * pool.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/*
+ * Pools of fixed-size blocks, allocated (and touched) at startup so that the
+ * steady state does no heap allocation.
+ *
+ * When a pool is empty, pool_alloc() gets a new block from the heap, that then
+ * stays in the pool. Built with ./configure --enable-fixed-footprint, it
+ * returns NULL instead.
+*/
+
+struct pool {
+    const char *name;
+    size_t block_size;
+    size_t nb_blocks;       // Blocks owned by the pool
+    size_t nb_free;
+    void *free_list;
+    unsigned long nb_exhausted;
+};
+
+    // Returns 0 if success, -1 if memory is missing.
+int pool_init(struct pool *p, const char *name, size_t block_size,
+        size_t nb_blocks);
+void *pool_alloc(struct pool *p);
+void pool_free(struct pool *p, void *block);
+size_t pool_footprint(const struct pool *p);
+
+    // Resident set size of the process, in bytes, 0 if unknown
+size_t resident_size();
+
+#ifdef FIXED_FOOTPRINT
+    // To call once initialization is over: from then on, heap allocations are
+    // counted.
+void heap_seal();
+unsigned long heap_allocs_after_seal();
+#endif
+
+#endif // POOL_H
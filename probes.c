@@ -0,0 +1,36 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * probes.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifdef ENABLE_USDT
+
+#include "probes.h"
+
+    // Probe semaphores, incremented by tracers when they attach to a probe.
+#define PROBE_DEFINE(name) \
+    unsigned short PROBE_SEMAPHORE(name) \
+        __attribute__((unused, section(".probes")));
+PROBES(PROBE_DEFINE)
+
+#endif // ENABLE_USDT
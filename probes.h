@@ -0,0 +1,100 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * probes.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * USDT static probes, for bpftrace, perf, systemtap...
+ * Built only with ./configure --enable-usdt, no-ops otherwise.
+ *
+ * Provider is mapper_devusb. All probes take as first arguments the device
+ * index (the number ending the device name, symlinks resolved: 3 for
+ * /dev/ttyACM3) and a timestamp (monotonic clock, usec):
+ *   received       (dev, ts, len)       message read from the FIFO
+ *   written        (dev, ts, len)       bytes written to the device
+ *   dropped        (dev, ts, len)       message lost, device write failed
+ *                                       (no queue) or queue full
+ *   coalesced      (dev, ts, len)       message or query not written on its
+ *                                       own: duplicate of an idempotency key
+ *                                       seen, or query collapsed with an
+ *                                       identical one
+ *   enqueued       (dev, ts, len)       message queued in memory
+ *   spilled        (dev, ts, len)       message queued on disk
+ *   replayed       (dev, ts, len)       queued message written
+ *   device_opened  (dev, ts, fd)
+ *   device_closed  (dev, ts, fd)
+ *   keepalive      (dev, ts, result)    keepalive sent, result 0 if success
+ *   reconnect      (dev, ts, downtime)  first write success after failures,
+ *                                       downtime in usec
+ *
+ * Example:
+ *   bpftrace -e 'usdt:./mapper-devusb:mapper_devusb:written { @[arg0] =
+ *       hist(arg2); }'
+ *
+ * Probes have semaphores: when no tracer is attached, arguments are not even
+ * evaluated.
+*/
+
+#define PROBES(P) \
+    P(received) \
+    P(written) \
+    P(dropped) \
+    P(coalesced) \
+    P(enqueued) \
+    P(spilled) \
+    P(replayed) \
+    P(device_opened) \
+    P(device_closed) \
+    P(keepalive) \
+    P(reconnect)
+
+#ifdef ENABLE_USDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#include "util.h"
+
+#define PROBE_SEMAPHORE(name) mapper_devusb_##name##_semaphore
+#define PROBE_DECLARE(name) extern unsigned short PROBE_SEMAPHORE(name);
+PROBES(PROBE_DECLARE)
+
+#define PROBE_ENABLED(name) __builtin_expect(PROBE_SEMAPHORE(name), 0)
+
+#define PROBE(name, dev, arg) \
+    do { \
+        if (PROBE_ENABLED(name)) { \
+            STAP_PROBE3(mapper_devusb, name, (dev), now_usec(), (arg)); \
+        } \
+    } while (0)
+
+#else
+
+#define PROBE(name, dev, arg) do { } while (0)
+
+#endif // ENABLE_USDT
+
+#endif // PROBES_H
@@ -0,0 +1,214 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * profile.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "util.h"
+#include "profile.h"
+#include "metrics.h"
+
+struct counter_def {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+};
+
+static struct counter_def counter_defs[] = {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "task_clock_ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    { "context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+        // Config (tracepoint id) is read from tracefs
+    { "syscalls", PERF_TYPE_TRACEPOINT, 0 }
+};
+#define NB_COUNTERS (sizeof(counter_defs) / sizeof(*counter_defs))
+#define COUNTER_SYSCALLS 4
+
+static const char *stage_names[NB_STAGES] = { "ingest", "dispatch", "write" };
+
+    // Leader of the counters group, -1 if profiling is off
+static int group_fd = -1;
+static int fds[NB_COUNTERS];
+    // Position of each counter in a group read, -1 if not available
+static int slot[NB_COUNTERS];
+static int nb_open = 0;
+
+static uint64_t last[NB_COUNTERS];
+static uint64_t sums[NB_STAGES][NB_COUNTERS];
+static unsigned long nb_samples[NB_STAGES];
+
+static long perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu,
+        int group, unsigned long flags) {
+    return syscall(__NR_perf_event_open, attr, pid, cpu, group, flags);
+}
+
+static int read_tracepoint_id(const char *event) {
+    static const char *roots[] = {
+        "/sys/kernel/tracing/events", "/sys/kernel/debug/tracing/events"
+    };
+    for (size_t i = 0; i < sizeof(roots) / sizeof(*roots); ++i) {
+        char path[128];
+        snprintf(path, sizeof(path), "%s/%s/id", roots[i], event);
+        FILE *f;
+        if ((f = fopen(path, "r")) != NULL) {
+            int id;
+            int n = fscanf(f, "%d", &id);
+            fclose(f);
+            if (n == 1)
+                return id;
+        }
+    }
+    return -1;
+}
+
+static int open_counter(const struct counter_def *def, int exclude_kernel) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = def->type;
+    attr.config = def->config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = exclude_kernel;
+    attr.exclude_hv = 1;
+    return perf_event_open(&attr, 0, -1, group_fd, 0);
+}
+
+int profile_open() {
+    int tp = read_tracepoint_id("raw_syscalls/sys_enter");
+    counter_defs[COUNTER_SYSCALLS].config = (tp == -1 ? 0 : tp);
+
+    for (size_t i = 0; i < NB_COUNTERS; ++i) {
+        slot[i] = -1;
+        fds[i] = -1;
+        if (i == COUNTER_SYSCALLS && tp == -1) {
+            l("profile: %s: not available: cannot read tracepoint id",
+              counter_defs[i].name);
+            continue;
+        }
+
+            // Counting kernel side is often restricted to root (see
+            // /proc/sys/kernel/perf_event_paranoid), then stick to user side.
+        int fd = open_counter(&counter_defs[i], 0);
+        int user_only = 0;
+        if (fd == -1 && (errno == EACCES || errno == EPERM)) {
+            fd = open_counter(&counter_defs[i], 1);
+            user_only = 1;
+        }
+        if (fd == -1) {
+            l("profile: %s: not available: %s", counter_defs[i].name,
+              strerror(errno));
+            continue;
+        }
+        if (user_only)
+            l("profile: %s: counting user space only", counter_defs[i].name);
+
+        if (group_fd == -1)
+            group_fd = fd;
+        fds[i] = fd;
+        slot[i] = nb_open++;
+    }
+
+    if (nb_open)
+        l("profile: %d counter(s) opened", nb_open);
+    return nb_open;
+}
+
+void profile_close() {
+    for (size_t i = 0; i < NB_COUNTERS; ++i) {
+        if (fds[i] != -1)
+            close(fds[i]);
+        fds[i] = -1;
+    }
+    group_fd = -1;
+    nb_open = 0;
+}
+
+static int read_counters(uint64_t *values) {
+        // Group read format: number of values then the values, in the order
+        // counters were opened.
+    uint64_t buf[1 + NB_COUNTERS];
+    ssize_t n = read(group_fd, buf, sizeof(buf));
+    if (n < (ssize_t)sizeof(uint64_t) || buf[0] != (uint64_t)nb_open)
+        return -1;
+
+    for (size_t i = 0; i < NB_COUNTERS; ++i)
+        values[i] = (slot[i] == -1 ? 0 : buf[1 + slot[i]]);
+    return 0;
+}
+
+void profile_start() {
+    if (group_fd == -1)
+        return;
+    read_counters(last);
+}
+
+void profile_stage_end(int stage) {
+    if (group_fd == -1)
+        return;
+
+    uint64_t now[NB_COUNTERS];
+    if (read_counters(now))
+        return;
+    for (size_t i = 0; i < NB_COUNTERS; ++i) {
+        sums[stage][i] += now[i] - last[i];
+        last[i] = now[i];
+    }
+        // The syscalls tracepoint fires when entering the read() of the
+        // counters, don't charge it to the stage.
+    if (slot[COUNTER_SYSCALLS] != -1)
+        --sums[stage][COUNTER_SYSCALLS];
+    ++nb_samples[stage];
+}
+
+void profile_write_metrics() {
+    if (group_fd == -1)
+        return;
+
+    for (size_t i = 0; i < NB_COUNTERS; ++i) {
+        if (slot[i] == -1)
+            continue;
+
+        const char *name = counter_defs[i].name;
+        metrics_printf("# HELP mapper_devusb_profile_%s_per_message Average "
+                       "%s per message, by stage\n", name, name);
+        metrics_printf("# TYPE mapper_devusb_profile_%s_per_message gauge\n",
+                       name);
+        for (int s = 0; s < NB_STAGES; ++s) {
+            double avg = (nb_samples[s] ?
+                          (double)sums[s][i] / nb_samples[s] : 0);
+            metrics_printf("mapper_devusb_profile_%s_per_message"
+                           "{stage=\"%s\"} %.1f\n", name, stage_names[s], avg);
+        }
+    }
+}
@@ -0,0 +1,66 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * profile.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/*
+ * Self-profiling with perf_event_open() counters, read around the stages every
+ * message goes through:
+ *   ingest    read from the FIFO and log
+ *   dispatch  decide what to do with the message
+ *   write     write to the device
+ *
+ * Usage, for each message:
+ *   profile_start();
+ *   ... ingest ...
+ *   profile_stage_end(STAGE_INGEST);
+ *   ... dispatch ...
+ *   profile_stage_end(STAGE_DISPATCH);
+ *   ... write ...
+ *   profile_stage_end(STAGE_WRITE);
+ *
+ * All calls are no-ops unless profile_open() succeeded.
+*/
+
+#define STAGE_INGEST   0
+#define STAGE_DISPATCH 1
+#define STAGE_WRITE    2
+#define NB_STAGES      3
+
+    // Opens the counters of the calling thread. Counters that are not
+    // available (hardware, permission) are logged and left out.
+    // Returns the number of counters opened.
+int profile_open();
+void profile_close();
+
+void profile_start();
+void profile_stage_end(int stage);
+
+    // Writes the average cost of each stage per message, in Prometheus text
+    // format (see metrics_printf()).
+void profile_write_metrics();
+
+#endif // PROFILE_H
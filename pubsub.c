@@ -0,0 +1,279 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * pubsub.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "util.h"
+#include "control.h"
+#include "metrics.h"
+#include "pubsub.h"
+
+    // As many as control clients
+#define MAX_WATCHERS 16
+#define MAX_PATTERNS 64
+#define MAX_NODES (MAX_PATTERNS * PUBSUB_PATTERN_MAX + 1)
+#define NO_NODE -1
+
+struct watcher {
+    int client;                 // -1 if the slot is free
+    enum pubsub_policy policy;
+};
+
+struct pattern {
+    int watcher;                // -1 if the slot is free
+    char text[PUBSUB_PATTERN_MAX + 1];
+};
+
+    // Children of a node are chained by sibling. watchers has bit i set if
+    // watcher i has a pattern ending there.
+struct node {
+    unsigned char c;
+    int child;
+    int sibling;
+    uint32_t watchers;
+};
+
+struct pubsub_stats pubsub_stats;
+
+static char device[64];
+static struct watcher watchers[MAX_WATCHERS];
+static struct pattern patterns[MAX_PATTERNS];
+static struct node trie[MAX_NODES];
+
+void pubsub_init(const char *dev) {
+    s_strncpy(device, dev, sizeof(device));
+    for (int i = 0; i < MAX_WATCHERS; ++i)
+        watchers[i].client = -1;
+    for (int i = 0; i < MAX_PATTERNS; ++i)
+        patterns[i].watcher = -1;
+    trie[0].child = NO_NODE;
+}
+
+    // Returns the line prefix of pattern if it applies to this device, NULL
+    // otherwise
+static const char *prefix_of(const char *pattern) {
+    const char *slash = strchr(pattern, '/');
+    size_t len = slash - pattern;
+    if ((len == 1 && *pattern == '*')
+            || (len == strlen(device) && !strncmp(pattern, device, len)))
+        return slash + 1;
+    return NULL;
+}
+
+    // Rebuilt from scratch at every change of the patterns
+static void compile() {
+    int nb_nodes = 1;
+    trie[0].child = NO_NODE;
+    trie[0].watchers = 0;
+    for (int p = 0; p < MAX_PATTERNS; ++p) {
+        const char *prefix;
+        if (patterns[p].watcher == -1
+                || (prefix = prefix_of(patterns[p].text)) == NULL)
+            continue;
+        int n = 0;
+        for (; *prefix; ++prefix) {
+            int ch = trie[n].child;
+            while (ch != NO_NODE && trie[ch].c != (unsigned char)*prefix)
+                ch = trie[ch].sibling;
+            if (ch == NO_NODE) {
+                ch = nb_nodes++;
+                trie[ch].c = *prefix;
+                trie[ch].child = NO_NODE;
+                trie[ch].sibling = trie[n].child;
+                trie[ch].watchers = 0;
+                trie[n].child = ch;
+            }
+            n = ch;
+        }
+        trie[n].watchers |= 1U << patterns[p].watcher;
+    }
+}
+
+static int find_watcher(int client) {
+    for (int i = 0; i < MAX_WATCHERS; ++i) {
+        if (watchers[i].client == client)
+            return i;
+    }
+    return -1;
+}
+
+    // Caller compiles the patterns afterwards
+static void remove_watcher(int w) {
+    for (int p = 0; p < MAX_PATTERNS; ++p) {
+        if (patterns[p].watcher == w)
+            patterns[p].watcher = -1;
+    }
+    watchers[w].client = -1;
+    --pubsub_stats.watchers;
+}
+
+    // Forgets watchers that left. Returns 1 if there were.
+static int prune() {
+    int removed = 0;
+    for (int w = 0; w < MAX_WATCHERS; ++w) {
+        if (watchers[w].client != -1 && !control_alive(watchers[w].client)) {
+            remove_watcher(w);
+            removed = 1;
+        }
+    }
+    return removed;
+}
+
+int pubsub_watch(int client, const char *pattern, enum pubsub_policy policy) {
+    if (!strchr(pattern, '/') || strlen(pattern) > PUBSUB_PATTERN_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (prune())
+        compile();
+
+    int w = find_watcher(client);
+    int free_pattern = -1;
+    for (int p = 0; p < MAX_PATTERNS; ++p) {
+        if (patterns[p].watcher == -1) {
+            if (free_pattern == -1)
+                free_pattern = p;
+        } else if (patterns[p].watcher == w
+                   && !strcmp(patterns[p].text, pattern)) {
+            watchers[w].policy = policy;
+            return 0;
+        }
+    }
+    if (w == -1)
+        w = find_watcher(-1);
+    if (w == -1 || free_pattern == -1) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    if (watchers[w].client == -1) {
+        watchers[w].client = client;
+        ++pubsub_stats.watchers;
+    }
+    watchers[w].policy = policy;
+    patterns[free_pattern].watcher = w;
+    s_strncpy(patterns[free_pattern].text, pattern,
+              sizeof(patterns[free_pattern].text));
+    compile();
+    return 0;
+}
+
+int pubsub_unwatch(int client, const char *pattern) {
+    int w;
+    if ((w = find_watcher(client)) == -1)
+        return -1;
+
+    int found = 0;
+    int others = 0;
+    for (int p = 0; p < MAX_PATTERNS; ++p) {
+        if (patterns[p].watcher != w)
+            continue;
+        if (!strcmp(patterns[p].text, pattern)) {
+            patterns[p].watcher = -1;
+            found = 1;
+        } else {
+            others = 1;
+        }
+    }
+    if (!found)
+        return -1;
+    if (!others)
+        remove_watcher(w);
+    compile();
+    return 0;
+}
+
+    // Returns 0 if the line got to the watcher or was dropped, -1 if the
+    // watcher is gone
+static int deliver(int w, const char *line, size_t len) {
+    struct watcher *wt = &watchers[w];
+    if (!control_push(wt->client, "%s/%.*s\n", device, (int)len, line)) {
+        ++pubsub_stats.published;
+        return 0;
+    }
+    if (!control_alive(wt->client)) {
+        remove_watcher(w);
+        return -1;
+    }
+    if (wt->policy == PUBSUB_DROP) {
+        ++pubsub_stats.dropped;
+        return 0;
+    }
+    l("watcher disconnected, not keeping up");
+    control_disconnect(wt->client);
+    remove_watcher(w);
+    ++pubsub_stats.disconnects;
+    return -1;
+}
+
+void pubsub_publish(const char *line, size_t len) {
+    uint32_t matched = trie[0].watchers;
+    int n = 0;
+    for (size_t i = 0; i < len && trie[n].child != NO_NODE; ++i) {
+        int ch = trie[n].child;
+        while (ch != NO_NODE && trie[ch].c != (unsigned char)line[i])
+            ch = trie[ch].sibling;
+        if (ch == NO_NODE)
+            break;
+        n = ch;
+        matched |= trie[n].watchers;
+    }
+
+    int disconnected = 0;
+    for (int w = 0; matched; ++w, matched >>= 1) {
+        if ((matched & 1) && deliver(w, line, len))
+            disconnected = 1;
+    }
+    if (disconnected)
+        compile();
+}
+
+void pubsub_write_metrics() {
+    if (!pubsub_stats.watchers && !pubsub_stats.published)
+        return;
+
+    metrics_printf("# HELP mapper_devusb_pubsub_watchers Control clients "
+                   "watching device lines\n");
+    metrics_printf("# TYPE mapper_devusb_pubsub_watchers gauge\n");
+    metrics_printf("mapper_devusb_pubsub_watchers %lu\n",
+                   pubsub_stats.watchers);
+    metrics_printf("# HELP mapper_devusb_pubsub_published_total Lines given "
+                   "to watchers\n");
+    metrics_printf("# TYPE mapper_devusb_pubsub_published_total counter\n");
+    metrics_printf("mapper_devusb_pubsub_published_total %lu\n",
+                   pubsub_stats.published);
+    metrics_printf("# HELP mapper_devusb_pubsub_dropped_total Lines dropped "
+                   "as a watcher did not keep up\n");
+    metrics_printf("# TYPE mapper_devusb_pubsub_dropped_total counter\n");
+    metrics_printf("mapper_devusb_pubsub_dropped_total %lu\n",
+                   pubsub_stats.dropped);
+    metrics_printf("# HELP mapper_devusb_pubsub_disconnects_total Watchers "
+                   "disconnected as they did not keep up\n");
+    metrics_printf("# TYPE mapper_devusb_pubsub_disconnects_total counter\n");
+    metrics_printf("mapper_devusb_pubsub_disconnects_total %lu\n",
+                   pubsub_stats.disconnects);
+}
@@ -0,0 +1,81 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * pubsub.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef PUBSUB_H
+#define PUBSUB_H
+
+#include <stddef.h>
+
+/*
+ * Lines read from the device, streamed to the control clients that watch
+ * matching topics (control command watch).
+ *
+ * The topic of a line is <device basename>/<line>, and is what watchers
+ * receive. A pattern is DEVICE/PREFIX, DEVICE being a device basename or *:
+ * it matches the lines of the device that start with PREFIX, all of them if
+ * PREFIX is empty. A pattern naming another device is accepted and never
+ * matches, so that the same watcher can be run against every daemon.
+ *
+ * Patterns are compiled into a trie of prefixes: matching a line costs the
+ * same whatever the number of watchers. Lines go whole to the output buffer
+ * of the watcher (see control.h), shared with its command replies so that
+ * they never mix. When it is full, a line is dropped (policy drop) or the
+ * watcher is disconnected (policy disconnect), the device is read on
+ * regardless.
+*/
+
+#define PUBSUB_PATTERN_MAX 64
+
+enum pubsub_policy {
+    PUBSUB_DROP,
+    PUBSUB_DISCONNECT
+};
+
+struct pubsub_stats {
+    unsigned long watchers;
+    unsigned long published;    // Lines given to watchers
+    unsigned long dropped;
+    unsigned long disconnects;
+};
+
+extern struct pubsub_stats pubsub_stats;
+
+    // device is the basename of the device file
+void pubsub_init(const char *device);
+
+    // client as given by control_client(). The policy applies to all patterns
+    // of client.
+    // Returns 0 on success, -1 on error: EINVAL if pattern is not valid,
+    // ENOSPC if there are too many watchers or patterns.
+int pubsub_watch(int client, const char *pattern, enum pubsub_policy policy);
+    // Returns 0 on success, -1 if client does not watch pattern
+int pubsub_unwatch(int client, const char *pattern);
+
+    // For every line read from the device
+void pubsub_publish(const char *line, size_t len);
+
+void pubsub_write_metrics();
+
+#endif // PUBSUB_H
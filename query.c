@@ -0,0 +1,188 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * query.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <errno.h>
+
+#include "util.h"
+#include "control.h"
+#include "metrics.h"
+#include "query.h"
+
+#define MAX_QUERIES 16
+#define MAX_WAITERS 16
+
+struct query {
+    char cmd[QUERY_MAX + 2];        // With trailing newline
+    size_t cmd_len;
+    char key[QUERY_MAX + 1];        // The answer starts with it
+    size_t key_len;
+    int nb_waiters;
+    int waiters[MAX_WAITERS];
+};
+
+struct query_stats query_stats;
+
+static long long timeout;           // msec
+static int (*send_query)(const char *buf, size_t len);
+
+    // queries[0] is on the wire if on_wire is set, held back by send_query()
+    // otherwise. deadline is when it fails, -1 if no query is pending.
+static struct query queries[MAX_QUERIES];
+static int nb_queries = 0;
+static int on_wire = 0;
+static long long deadline = -1;
+
+void query_init(int timeout_ms, int (*send)(const char *buf, size_t len)) {
+    timeout = timeout_ms;
+    send_query = send;
+}
+
+    // Replies to all waiters of queries[0], with the answer or with error if
+    // not NULL, and removes it
+static void finish(const char *answer, const char *error) {
+    for (int i = 0; i < queries[0].nb_waiters; ++i) {
+        if (error)
+            control_reply(queries[0].waiters[i], "error: %s\n", error);
+        else
+            control_reply(queries[0].waiters[i], "%s\nok\n", answer);
+    }
+    --nb_queries;
+    memmove(queries, queries + 1, nb_queries * sizeof(*queries));
+    on_wire = 0;
+    deadline = -1;
+}
+
+static void send_next() {
+    while (nb_queries && !on_wire) {
+            // A query held back fails as one not answered would
+        if (deadline == -1)
+            deadline = now_msec() + timeout;
+        int r = send_query(queries[0].cmd, queries[0].cmd_len);
+        if (r > 0)
+            return;
+        ++query_stats.sent;
+        if (r) {
+            finish(NULL, "cannot write to device");
+            continue;
+        }
+        on_wire = 1;
+        deadline = now_msec() + timeout;
+    }
+}
+
+void query_retry() {
+    send_next();
+}
+
+int query_held() {
+    return nb_queries && !on_wire;
+}
+
+int query_submit(const char *cmd, int client) {
+    size_t len = strlen(cmd);
+    if (!len || len > QUERY_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    ++query_stats.requests;
+
+    for (int i = 0; i < nb_queries; ++i) {
+        struct query *q = &queries[i];
+        if (q->cmd_len == len + 1 && !strncmp(q->cmd, cmd, len)
+                && q->nb_waiters < MAX_WAITERS) {
+            q->waiters[q->nb_waiters++] = client;
+            return 1;
+        }
+    }
+
+    if (nb_queries == MAX_QUERIES) {
+        errno = EBUSY;
+        return -1;
+    }
+    struct query *q = &queries[nb_queries++];
+    memcpy(q->cmd, cmd, len);
+    q->cmd[len] = '\n';
+    q->cmd[len + 1] = '\0';
+    q->cmd_len = len + 1;
+    q->key_len = strcspn(cmd, " \t");
+    memcpy(q->key, cmd, q->key_len);
+    while (q->key_len > 1 && q->key[q->key_len - 1] == '?')
+        --q->key_len;
+    q->key[q->key_len] = '\0';
+    q->nb_waiters = 1;
+    q->waiters[0] = client;
+
+    send_next();
+    return 0;
+}
+
+void query_response(const char *line, size_t len) {
+    if (!on_wire)
+        return;
+
+    const struct query *q = &queries[0];
+    if (len < q->key_len || strncmp(line, q->key, q->key_len)
+            || (len > q->key_len && !strchr(" \t:=", line[q->key_len])))
+        return;
+
+    finish(line, NULL);
+    send_next();
+}
+
+long long query_expire(long long now) {
+    if (deadline != -1 && now >= deadline) {
+        ++query_stats.timeouts;
+        finish(NULL, on_wire ? "no answer from device"
+                             : "device busy, query not written");
+        send_next();
+    }
+    return deadline;
+}
+
+void query_write_metrics() {
+    if (!query_stats.requests)
+        return;
+
+    metrics_printf("# HELP mapper_devusb_query_requests_total Queries from "
+                   "clients\n");
+    metrics_printf("# TYPE mapper_devusb_query_requests_total counter\n");
+    metrics_printf("mapper_devusb_query_requests_total %lu\n",
+                   query_stats.requests);
+    metrics_printf("# HELP mapper_devusb_query_sent_total Queries written to "
+                   "the device\n");
+    metrics_printf("# TYPE mapper_devusb_query_sent_total counter\n");
+    metrics_printf("mapper_devusb_query_sent_total %lu\n", query_stats.sent);
+    metrics_printf("# HELP mapper_devusb_query_timeouts_total Queries the "
+                   "device did not answer\n");
+    metrics_printf("# TYPE mapper_devusb_query_timeouts_total counter\n");
+    metrics_printf("mapper_devusb_query_timeouts_total %lu\n",
+                   query_stats.timeouts);
+    metrics_printf("# HELP mapper_devusb_query_collapse_ratio Share of client "
+                   "queries answered without a device query of their own\n");
+    metrics_printf("# TYPE mapper_devusb_query_collapse_ratio gauge\n");
+    metrics_printf("mapper_devusb_query_collapse_ratio %.3f\n",
+                   1 - (double)query_stats.sent / query_stats.requests);
+}
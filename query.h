@@ -0,0 +1,77 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * query.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stddef.h>
+
+/*
+ * Queries to the board, from control clients (command query).
+ *
+ * The board is expected to answer a query with a line starting with the first
+ * word of the query, trailing '?' removed: "temp?" is answered by a line like
+ * "temp 21.5".
+ *
+ * One query is on the wire at a time. A query identical to one pending or on
+ * the wire is not sent again: the answer goes to every client waiting for it.
+ * A query the device cannot take yet is held back, and fails if it is still
+ * after the timeout.
+*/
+
+#define QUERY_MAX 128
+
+struct query_stats {
+    unsigned long requests;     // From clients
+    unsigned long sent;         // To the device
+    unsigned long timeouts;
+};
+
+extern struct query_stats query_stats;
+
+    // send writes a query to the device, returns 0 on success, -1 on failure,
+    // 1 if it cannot be written yet: it is then tried again by query_retry()
+void query_init(int timeout_ms, int (*send)(const char *buf, size_t len));
+
+    // client as given by control_client(), to reply to.
+    // Returns 0 if the query got registered, 1 if it joined an identical one
+    // (collapsed), -1 otherwise (errno set).
+int query_submit(const char *cmd, int client);
+
+    // Tries again to send the query held back, if any
+void query_retry();
+    // Tells whether a query waits to be written
+int query_held();
+
+    // For every line read from the device
+void query_response(const char *line, size_t len);
+
+    // Fails queries waiting for too long, returns the time (msec) the first
+    // one will, -1 if none.
+long long query_expire(long long now);
+
+void query_write_metrics();
+
+#endif // QUERY_H
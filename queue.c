@@ -0,0 +1,555 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * queue.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "util.h"
+#include "queue.h"
+
+    // Records are a 2-byte length, the 8-byte reception time of the message,
+    // then the message, in memory and in segments alike.
+typedef uint16_t reclen_t;
+typedef int64_t stamp_t;
+#define HEADER_SIZE (sizeof(reclen_t) + sizeof(stamp_t))
+#define RECORD_SIZE(len) (HEADER_SIZE + (len))
+#define MAX_MESSAGE BUFSIZ
+    // Set in the length of a record of a segment whose message got cancelled,
+    // see queue_close(). Such records are skipped when read.
+#define RECORD_CANCELLED 0x8000
+
+    // A new segment is started beyond this size
+#define SEGMENT_SIZE (1024 * 1024)
+    // Sequence number of the first segment. Segments written at termination
+    // take the numbers before, so it leaves room both ways.
+#define FIRST_SEQ 1000000000UL
+#define SEGMENT_SUFFIX ".spill"
+#define SEGMENT_NAME_MAX (PATH_MAX + NAME_MAX + 32)
+
+struct queue_stats queue_stats;
+
+static char *ring = NULL;
+static size_t ring_size = 0;
+static size_t ring_head = 0;
+static unsigned long ring_messages = 0;
+
+static char spill_dir[PATH_MAX];
+static char prefix[NAME_MAX + 1];   // Device basename
+static unsigned long nb_segments = 0;
+static unsigned long head_seq;      // Segment read
+static int head_fd = -1;
+static off_t head_off = 0;
+static unsigned long tail_seq;      // Segment appended to
+static int tail_fd = -1;
+static off_t tail_size = 0;
+
+    // One record, read from or written to a segment
+static char record[RECORD_SIZE(MAX_MESSAGE)];
+
+static void ring_put(const void *data, size_t n) {
+    size_t pos = (ring_head + queue_stats.memory_bytes) % ring_size;
+    size_t first = (n < ring_size - pos ? n : ring_size - pos);
+    memcpy(ring + pos, data, first);
+    memcpy(ring, (const char *)data + first, n - first);
+    queue_stats.memory_bytes += n;
+}
+
+static void ring_get(size_t offset, void *data, size_t n) {
+    size_t pos = (ring_head + offset) % ring_size;
+    size_t first = (n < ring_size - pos ? n : ring_size - pos);
+    memcpy(data, ring + pos, first);
+    memcpy((char *)data + first, ring, n - first);
+}
+
+static size_t ring_free() {
+    return ring_size - queue_stats.memory_bytes;
+}
+
+static void segment_name(char *name, size_t size, unsigned long seq) {
+    snprintf(name, size, "%s/%s.%010lu" SEGMENT_SUFFIX, spill_dir, prefix,
+             seq);
+}
+
+    // Returns the sequence number of a segment file name, 0 if it is not one
+static unsigned long segment_seq(const char *file_name) {
+    size_t prefix_len = strlen(prefix);
+    size_t len = strlen(file_name);
+    if (strncmp(file_name, prefix, prefix_len) || file_name[prefix_len] != '.'
+            || len < strlen(SEGMENT_SUFFIX)
+            || strcmp(file_name + len - strlen(SEGMENT_SUFFIX),
+                      SEGMENT_SUFFIX))
+        return 0;
+    char *end;
+    unsigned long seq = strtoul(file_name + prefix_len + 1, &end, 10);
+    return (end == file_name + len - strlen(SEGMENT_SUFFIX) ? seq : 0);
+}
+
+    // Counts the records of a segment
+static unsigned long segment_messages(int fd, off_t size) {
+    unsigned long n = 0;
+    off_t off = 0;
+    reclen_t len;
+    while (off < size && pread(fd, &len, sizeof(len), off) == sizeof(len)) {
+        if (!(len & RECORD_CANCELLED))
+            ++n;
+        off += RECORD_SIZE(len & ~RECORD_CANCELLED);
+    }
+    return n;
+}
+
+    // Segments left by a previous run
+static void load_segments() {
+    DIR *dir;
+    if ((dir = opendir(spill_dir)) == NULL) {
+        l("error: queue: cannot open directory '%s': %s", spill_dir,
+          strerror(errno));
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        unsigned long seq;
+        if (!(seq = segment_seq(ent->d_name)))
+            continue;
+        if (!nb_segments || seq < head_seq)
+            head_seq = seq;
+        if (!nb_segments || seq > tail_seq)
+            tail_seq = seq;
+        ++nb_segments;
+    }
+    closedir(dir);
+
+    if (!nb_segments)
+        return;
+    if (nb_segments != tail_seq - head_seq + 1)
+        l("warning: queue: segments %lu to %lu: some are missing", head_seq,
+          tail_seq);
+    nb_segments = tail_seq - head_seq + 1;
+
+    for (unsigned long seq = head_seq; seq <= tail_seq; ++seq) {
+        char name[SEGMENT_NAME_MAX];
+        segment_name(name, sizeof(name), seq);
+        int fd;
+        struct stat st;
+        if ((fd = open(name, O_RDONLY)) == -1)
+            continue;
+        if (!fstat(fd, &st)) {
+            queue_stats.disk_bytes += st.st_size;
+            queue_stats.messages += segment_messages(fd, st.st_size);
+        }
+        close(fd);
+    }
+    l("queue: %lu message(s) left by previous run, in %lu segment(s)",
+      queue_stats.messages, nb_segments);
+}
+
+int queue_init(size_t memory, const char *dir, const char *dev) {
+    if (memory < RECORD_SIZE(MAX_MESSAGE))
+        memory = RECORD_SIZE(MAX_MESSAGE);
+    if ((ring = malloc(memory)) == NULL)
+        return -1;
+    ring_size = memory;
+
+    s_strncpy(spill_dir, dir, sizeof(spill_dir));
+    const char *base = strrchr(dev, '/');
+    s_strncpy(prefix, base ? base + 1 : dev, sizeof(prefix));
+
+    if (strlen(spill_dir))
+        load_segments();
+
+    return 0;
+}
+
+int queue_enabled() {
+    return ring != NULL;
+}
+
+int queue_empty() {
+    return !queue_stats.messages;
+}
+
+static int spill(const char *buf, size_t len, long long received_at) {
+    if (tail_fd != -1 && tail_size >= SEGMENT_SIZE) {
+        close(tail_fd);
+        tail_fd = -1;
+        ++tail_seq;
+        ++nb_segments;
+        tail_size = 0;
+    } else if (!nb_segments) {
+        head_seq = tail_seq = FIRST_SEQ;
+        head_off = 0;
+        nb_segments = 1;
+        tail_size = 0;
+    }
+
+    if (tail_fd == -1) {
+        char name[SEGMENT_NAME_MAX];
+        segment_name(name, sizeof(name), tail_seq);
+        if ((tail_fd = open(name, O_WRONLY | O_CREAT | O_APPEND, 0600)) == -1) {
+            l("error: queue: cannot open '%s': %s", name, strerror(errno));
+            return -1;
+        }
+        struct stat st;
+        tail_size = (fstat(tail_fd, &st) ? 0 : st.st_size);
+    }
+
+    reclen_t reclen = len;
+    stamp_t stamp = received_at;
+    memcpy(record, &reclen, sizeof(reclen));
+    memcpy(record + sizeof(reclen), &stamp, sizeof(stamp));
+    memcpy(record + HEADER_SIZE, buf, len);
+    ssize_t n = write(tail_fd, record, RECORD_SIZE(len));
+    if (n != (ssize_t)RECORD_SIZE(len)) {
+        l("error: queue: cannot write segment %lu: %s", tail_seq,
+          n == -1 ? strerror(errno) : "short write");
+            // Partial record: truncate it
+        if (n > 0 && ftruncate(tail_fd, tail_size))
+            l("error: queue: cannot truncate segment %lu", tail_seq);
+        return -1;
+    }
+    tail_size += n;
+    queue_stats.disk_bytes += n;
+
+    return 0;
+}
+
+int queue_push(const char *buf, size_t len, long long received_at) {
+    if (len > MAX_MESSAGE) {
+        ++queue_stats.dropped;
+        return -1;
+    }
+
+        // Once spilling started, everything goes to disk until segments have
+        // been read back.
+    if (!nb_segments && ring_free() >= RECORD_SIZE(len)) {
+            // The header in one go, as the ring may wrap in the middle
+        char header[HEADER_SIZE];
+        reclen_t reclen = len;
+        stamp_t stamp = received_at;
+        memcpy(header, &reclen, sizeof(reclen));
+        memcpy(header + sizeof(reclen), &stamp, sizeof(stamp));
+        ring_put(header, sizeof(header));
+        ring_put(buf, len);
+        ++ring_messages;
+        ++queue_stats.messages;
+        return QUEUE_IN_MEMORY;
+    }
+
+    if (!strlen(spill_dir) || spill(buf, len, received_at)) {
+        ++queue_stats.dropped;
+        return -1;
+    }
+    ++queue_stats.spilled;
+    ++queue_stats.messages;
+    return QUEUE_SPILLED;
+}
+
+static void drop_head_segment() {
+    char name[SEGMENT_NAME_MAX];
+    segment_name(name, sizeof(name), head_seq);
+
+    if (head_fd != -1)
+        close(head_fd);
+    head_fd = -1;
+    head_off = 0;
+    unlink(name);
+
+    if (head_seq == tail_seq) {
+        if (tail_fd != -1)
+            close(tail_fd);
+        tail_fd = -1;
+        nb_segments = 0;
+    } else {
+        ++head_seq;
+        --nb_segments;
+    }
+}
+
+    // Size of the segment read. It may be the one appended to, that grows
+static off_t head_end() {
+    struct stat st;
+    if (head_seq == tail_seq && tail_fd != -1)
+        return tail_size;
+    return (fstat(head_fd, &st) ? head_off : st.st_size);
+}
+
+    // Reads what follows the length of the record at off into record.
+    // Returns 1 on success.
+static int read_record(int fd, off_t off, reclen_t len) {
+    ssize_t n = RECORD_SIZE(len) - sizeof(len);
+    return pread(fd, record, n, off + sizeof(len)) == n;
+}
+
+    // Moves messages from segments to the ring, as long as they fit
+static void refill() {
+    while (nb_segments) {
+        if (head_fd == -1) {
+            char name[SEGMENT_NAME_MAX];
+            segment_name(name, sizeof(name), head_seq);
+            if ((head_fd = open(name, O_RDONLY)) == -1) {
+                l("error: queue: cannot read '%s': %s", name,
+                  strerror(errno));
+                drop_head_segment();
+                continue;
+            }
+        }
+        off_t end = head_end();
+
+        while (head_off < end) {
+            reclen_t len;
+            if (pread(head_fd, &len, sizeof(len), head_off) == sizeof(len)
+                    && (len & RECORD_CANCELLED)) {
+                len &= ~RECORD_CANCELLED;
+                head_off += RECORD_SIZE(len);
+                queue_stats.disk_bytes -= RECORD_SIZE(len);
+                continue;
+            }
+            if (pread(head_fd, &len, sizeof(len), head_off) != sizeof(len)
+                    || len > MAX_MESSAGE || RECORD_SIZE(len) > ring_size
+                    || !read_record(head_fd, head_off, len)) {
+                l("error: queue: segment %lu corrupted at offset %lld, "
+                  "skipping the rest", head_seq, (long long)head_off);
+                queue_stats.disk_bytes -= end - head_off;
+                head_off = end;
+                break;
+            }
+            if (ring_free() < RECORD_SIZE(len))
+                return;
+            ring_put(&len, sizeof(len));
+            ring_put(record, RECORD_SIZE(len) - sizeof(len));
+            ++ring_messages;
+            head_off += RECORD_SIZE(len);
+            queue_stats.disk_bytes -= RECORD_SIZE(len);
+        }
+        drop_head_segment();
+    }
+        // Corrupted segments may have had fewer messages than counted
+    queue_stats.messages = ring_messages;
+}
+
+size_t queue_peek(char *buf, size_t size, long long *received_at) {
+    if (!ring_messages)
+        refill();
+    if (!ring_messages)
+        return 0;
+
+    char header[HEADER_SIZE];
+    reclen_t len;
+    stamp_t stamp;
+    ring_get(0, header, sizeof(header));
+    memcpy(&len, header, sizeof(len));
+    memcpy(&stamp, header + sizeof(len), sizeof(stamp));
+    *received_at = stamp;
+    if (len > size)
+        len = size;
+    ring_get(HEADER_SIZE, buf, len);
+    return len;
+}
+
+    // Returns the size of the record removed
+static size_t ring_drop() {
+    reclen_t len;
+    ring_get(0, &len, sizeof(len));
+    ring_head = (ring_head + RECORD_SIZE(len)) % ring_size;
+    queue_stats.memory_bytes -= RECORD_SIZE(len);
+    --ring_messages;
+    return RECORD_SIZE(len);
+}
+
+    // Like queue_peek(), so that what queue_dump() goes through, segments
+    // included, can be popped
+int queue_pop() {
+    if (!ring_messages)
+        refill();
+    if (!ring_messages)
+        return -1;
+
+    ring_drop();
+    --queue_stats.messages;
+    ++queue_stats.replayed;
+    return 0;
+}
+
+unsigned long queue_clear() {
+    unsigned long n = queue_stats.messages;
+
+    while (ring_messages)
+        ring_drop();
+    while (nb_segments)
+        drop_head_segment();
+    queue_stats.messages = 0;
+    queue_stats.disk_bytes = 0;
+
+    return n;
+}
+
+void queue_dump(int (*func)(const char *buf, size_t len,
+                            long long received_at, void *arg),
+                void *arg, unsigned long max) {
+    size_t offset = 0;
+    stamp_t stamp;
+    for (unsigned long i = 0; i < ring_messages && max; ++i, --max) {
+        reclen_t len;
+        ring_get(offset, &len, sizeof(len));
+        ring_get(offset + sizeof(len), record, RECORD_SIZE(len) - sizeof(len));
+        memcpy(&stamp, record, sizeof(stamp));
+        if (func(record + sizeof(stamp), len, stamp, arg))
+            return;
+        offset += RECORD_SIZE(len);
+    }
+
+    for (unsigned long seq = head_seq; nb_segments && seq <= tail_seq && max;
+            ++seq) {
+        char name[SEGMENT_NAME_MAX];
+        segment_name(name, sizeof(name), seq);
+        int fd;
+        if ((fd = open(name, O_RDONLY)) == -1)
+            continue;
+        off_t off = (seq == head_seq ? head_off : 0);
+        reclen_t len;
+        while (max && pread(fd, &len, sizeof(len), off) == sizeof(len)) {
+            if (len & RECORD_CANCELLED) {
+                off += RECORD_SIZE(len & ~RECORD_CANCELLED);
+                continue;
+            }
+            if (len > MAX_MESSAGE || !read_record(fd, off, len))
+                break;
+            memcpy(&stamp, record, sizeof(stamp));
+            if (func(record + sizeof(stamp), len, stamp, arg)) {
+                close(fd);
+                return;
+            }
+            off += RECORD_SIZE(len);
+            --max;
+        }
+        close(fd);
+    }
+}
+
+    // Flags the records of segments whose messages got cancelled, i being the
+    // position in the queue of the first message of the segments. Stops once
+    // nb of them have been found.
+    // Returns the number of records flagged.
+static unsigned long flag_cancelled(int (*cancelled)(unsigned long i),
+                                    unsigned long i, unsigned long nb) {
+    unsigned long flagged = 0;
+    for (unsigned long seq = head_seq; nb_segments && seq <= tail_seq
+            && flagged < nb; ++seq) {
+        char name[SEGMENT_NAME_MAX];
+        segment_name(name, sizeof(name), seq);
+        int fd;
+        if ((fd = open(name, O_RDWR)) == -1)
+            continue;
+        off_t off = (seq == head_seq ? head_off : 0);
+        reclen_t len;
+        while (flagged < nb
+                && pread(fd, &len, sizeof(len), off) == sizeof(len)) {
+            if (!(len & RECORD_CANCELLED) && cancelled(i++)) {
+                len |= RECORD_CANCELLED;
+                if (pwrite(fd, &len, sizeof(len), off) != sizeof(len)) {
+                    l("error: queue: cannot write segment %lu: %s", seq,
+                      strerror(errno));
+                    break;
+                }
+                ++flagged;
+            }
+            off += RECORD_SIZE(len & ~RECORD_CANCELLED);
+        }
+        close(fd);
+    }
+    return flagged;
+}
+
+    // Messages in memory come before those in segments: they are written to
+    // the segment preceding the first one, followed by what is left of the
+    // latter. Cancelled messages are left out, or flagged in segments.
+void queue_close(int (*cancelled)(unsigned long i), unsigned long nb) {
+    if (!queue_enabled())
+        return;
+
+    if (!strlen(spill_dir)) {
+        if (queue_stats.messages)
+            l("queue: %lu message(s) lost", queue_stats.messages);
+        return;
+    }
+
+        // Before the ring is emptied, as it comes first
+    unsigned long in_ring = 0;
+    for (unsigned long i = 0; nb && i < ring_messages; ++i)
+        in_ring += cancelled(i);
+    unsigned long kept = queue_stats.messages - in_ring;
+    if (nb > in_ring)
+        kept -= flag_cancelled(cancelled, ring_messages, nb - in_ring);
+    if (ring_messages == in_ring && !head_off) {
+        while (ring_messages)
+            ring_drop();
+        return;
+    }
+
+    unsigned long seq = (nb_segments ? head_seq - 1 : FIRST_SEQ);
+    char name[SEGMENT_NAME_MAX];
+    segment_name(name, sizeof(name), seq);
+    int fd;
+    if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1) {
+        l("error: queue: cannot open '%s': %s", name, strerror(errno));
+        return;
+    }
+
+    int ok = 1;
+    for (unsigned long i = 0; ring_messages && ok; ++i) {
+        reclen_t len;
+        ring_get(0, &len, sizeof(len));
+        if (in_ring && cancelled(i)) {
+            ring_drop();
+            continue;
+        }
+        ring_get(0, record, RECORD_SIZE(len));
+        ok = (write(fd, record, RECORD_SIZE(len))
+              == (ssize_t)RECORD_SIZE(len));
+        queue_stats.disk_bytes += ring_drop();
+    }
+    if (ok && head_off && head_fd != -1) {
+        off_t end = head_end();
+        ssize_t n;
+        while (ok && head_off < end
+                && (n = pread(head_fd, record, sizeof(record), head_off)) > 0) {
+            ok = (write(fd, record, n) == n);
+            head_off += n;
+        }
+        if (ok)
+            drop_head_segment();
+    }
+    if (close(fd) || !ok)
+        l("error: queue: cannot write '%s': %s", name, strerror(errno));
+    else
+        l("queue: %lu message(s) kept for next start", kept);
+}
@@ -0,0 +1,92 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * queue.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <sys/types.h>
+
+/*
+ * Messages waiting for the device, while it is unavailable.
+ *
+ * They are kept in a ring of fixed size in memory. When it is full, messages
+ * go to append-only segment files in the spill directory, and keep going there
+ * until the segments have been read back, so that order is kept. Memory in use
+ * does not depend on the duration of the outage.
+ *
+ * Segments are named <device basename>.<sequence number>.spill and are left
+ * on disk at termination, along with what the ring held, for the next start.
+*/
+
+struct queue_stats {
+    unsigned long messages;         // Queued, in memory and on disk
+    size_t memory_bytes;
+    unsigned long long disk_bytes;
+    unsigned long spilled;          // Messages written to segments
+    unsigned long replayed;         // Messages taken out of the queue
+    unsigned long dropped;          // Messages lost, queue full
+};
+
+extern struct queue_stats queue_stats;
+
+#define QUEUE_IN_MEMORY 0
+#define QUEUE_SPILLED   1
+
+    // memory: size of the ring, in bytes
+    // spill_dir: empty string if messages must not go to disk
+    // Returns 0 on success, -1 on error (errno set)
+int queue_init(size_t memory, const char *spill_dir, const char *dev);
+
+int queue_enabled();
+int queue_empty();
+
+    // received_at: reception time of the message, kept along with it. Wall
+    // clock time, as messages may outlive the run.
+    // Returns QUEUE_IN_MEMORY, QUEUE_SPILLED or -1 if the message is lost
+int queue_push(const char *buf, size_t len, long long received_at);
+
+    // Copies the oldest message to buf and returns its length, 0 if the queue
+    // is empty. Sets *received_at.
+size_t queue_peek(char *buf, size_t size, long long *received_at);
+    // Removes the oldest message, be it in memory or in a segment. Returns 0,
+    // -1 if the queue is empty.
+int queue_pop();
+
+    // Removes all messages, returns how many were
+unsigned long queue_clear();
+
+    // Calls func for the first max messages, oldest first, until it returns
+    // non-zero. Messages in segments are included, in the order queue_pop()
+    // removes them.
+void queue_dump(int (*func)(const char *buf, size_t len,
+                            long long received_at, void *arg),
+                void *arg, unsigned long max);
+
+    // Writes messages still in memory to a segment. The nb messages cancelled
+    // (cancelled(i) returning 1 for the i-th message from the oldest one) are
+    // not kept.
+void queue_close(int (*cancelled)(unsigned long i), unsigned long nb);
+
+#endif // QUEUE_H
@@ -0,0 +1,271 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * series.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <linux/limits.h>
+
+#include "util.h"
+#include "metrics.h"
+#include "series.h"
+
+    // After a failure to create a chunk, samples are dropped for that long
+    // (msec), not to flood the log
+#define RETRY_DELAY 60000
+
+struct series_stats series_stats;
+
+    // Data is zeroed to begin with
+static void put_bits(uint8_t *data, uint64_t *pos, uint64_t v, int n) {
+    for (int i = n - 1; i >= 0; --i, ++*pos) {
+        if ((v >> i) & 1)
+            data[*pos >> 3] |= 0x80 >> (*pos & 7);
+    }
+}
+
+static uint64_t double_bits(double d) {
+    uint64_t v;
+    memcpy(&v, &d, sizeof(v));
+    return v;
+}
+
+    // Caller makes sure the delta of delta fits in 32 bits
+static void encode_time(uint8_t *data, uint64_t *pos, struct series_key *k,
+                        uint64_t time) {
+    int64_t delta = time - k->time;
+    int64_t dod = delta - k->delta;
+    k->time = time;
+    k->delta = delta;
+
+    int c = 0;
+    if (dod) {
+        for (c = 1; c < SERIES_DOD_CLASSES - 1; ++c) {
+            int64_t half = 1LL << (series_dod_bits(c) - 1);
+            if (dod >= -half && dod < half)
+                break;
+        }
+    }
+    put_bits(data, pos, (1U << c) - 1, c);
+    if (c < SERIES_DOD_CLASSES - 1)
+        put_bits(data, pos, 0, 1);
+    put_bits(data, pos, (uint64_t)dod, series_dod_bits(c));
+}
+
+static void encode_value(uint8_t *data, uint64_t *pos, struct series_key *k,
+                         uint64_t v) {
+    uint64_t x = v ^ k->value;
+    k->value = v;
+    if (!x) {
+        put_bits(data, pos, 0, 1);
+        return;
+    }
+
+    int leading = __builtin_clzll(x);
+    int trailing = __builtin_ctzll(x);
+    if (leading > 31)
+        leading = 31;
+    if (k->leading != -1 && leading >= k->leading && trailing >= k->trailing) {
+        put_bits(data, pos, 2, 2);
+        put_bits(data, pos, x >> k->trailing, 64 - k->leading - k->trailing);
+    } else {
+        int len = 64 - leading - trailing;
+        put_bits(data, pos, 3, 2);
+        put_bits(data, pos, leading, 5);
+        put_bits(data, pos, len - 1, 6);
+        put_bits(data, pos, x >> trailing, len);
+        k->leading = leading;
+        k->trailing = trailing;
+    }
+}
+
+static char series_dir[PATH_MAX];
+static char device[64];             // Basename
+static uint64_t chunk_msec;
+static int opened = 0;
+static long long retry_after = 0;
+
+static struct series_header *chunk = NULL;
+static uint8_t *chunk_data;
+static int chunk_fd;
+static struct series_key keys[SERIES_MAX_KEYS];
+
+int series_open(const char *dir, const char *dev_file_name, int chunk_sec) {
+    if (access(dir, W_OK)) {
+        l("error: series: cannot write to '%s': %s", dir, strerror(errno));
+        return -1;
+    }
+    s_strncpy(series_dir, dir, sizeof(series_dir));
+    const char *base = strrchr(dev_file_name, '/');
+    s_strncpy(device, base ? base + 1 : dev_file_name, sizeof(device));
+    chunk_msec = chunk_sec * 1000LL;
+    opened = 1;
+    return 0;
+}
+
+    // Gives back the space reserved and not used
+static void close_chunk() {
+    if (!chunk)
+        return;
+    off_t used = sizeof(*chunk) + (chunk->bits + 7) / 8;
+    msync(chunk, SERIES_CHUNK_SIZE, MS_SYNC);
+    munmap(chunk, SERIES_CHUNK_SIZE);
+    chunk = NULL;
+    if (ftruncate(chunk_fd, used))
+        l("warning: series: cannot truncate chunk: %s", strerror(errno));
+    close(chunk_fd);
+}
+
+static int new_chunk(uint64_t now) {
+    char file_name[PATH_MAX];
+    if (snprintf(file_name, sizeof(file_name), "%s/%s.%013llu" SERIES_SUFFIX,
+                 series_dir, device, (unsigned long long)now)
+            >= (int)sizeof(file_name)) {
+        l("error: series: chunk file name too long");
+        return -1;
+    }
+
+    int fd;
+    if ((fd = open(file_name, O_RDWR | O_CREAT | O_EXCL, 0644)) == -1) {
+        l("error: series: cannot create '%s': %s", file_name, strerror(errno));
+        return -1;
+    }
+    void *p = MAP_FAILED;
+    if (ftruncate(fd, SERIES_CHUNK_SIZE)
+            || (p = mmap(NULL, SERIES_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        l("error: series: cannot map '%s': %s", file_name, strerror(errno));
+        close(fd);
+        unlink(file_name);
+        return -1;
+    }
+
+    chunk = p;
+    chunk_data = (uint8_t *)p + sizeof(*chunk);
+    chunk_fd = fd;
+    chunk->magic = SERIES_MAGIC;
+    chunk->version = SERIES_VERSION;
+    chunk->size = sizeof(*chunk);
+    s_strncpy(chunk->device, device, sizeof(chunk->device));
+    chunk->start = now;
+    memset(keys, 0, sizeof(keys));
+    ++series_stats.chunks;
+    DBG("series chunk: '%s'", file_name);
+    return 0;
+}
+
+static int key_index(const char *key) {
+    for (uint32_t i = 0; i < chunk->nb_keys; ++i) {
+        if (!strcmp(chunk->keys[i], key))
+            return i;
+    }
+    return -1;
+}
+
+void series_close() {
+    close_chunk();
+    opened = 0;
+}
+
+void series_add(const char *key, double value) {
+    if (!opened)
+        return;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+        // Timestamps stay within chunk_msec of the start (the clock may
+        // step back), so that a delta of delta fits in 32 bits.
+    if (chunk && (now < chunk->start || now - chunk->start >= chunk_msec
+                  || chunk->bits + SERIES_RECORD_MAX > SERIES_DATA_BITS
+                  || (chunk->nb_keys == SERIES_MAX_KEYS
+                      && key_index(key) == -1)))
+        close_chunk();
+    if (!chunk) {
+        if ((long long)now < retry_after)
+            return;
+        if (new_chunk(now)) {
+            retry_after = now + RETRY_DELAY;
+            return;
+        }
+    }
+
+    int k;
+    if ((k = key_index(key)) == -1) {
+        k = chunk->nb_keys;
+        s_strncpy(chunk->keys[k], key, sizeof(chunk->keys[k]));
+        __atomic_store_n(&chunk->nb_keys, k + 1, __ATOMIC_RELEASE);
+    }
+
+    uint64_t pos = chunk->bits;
+    put_bits(chunk_data, &pos, k, SERIES_KEY_BITS);
+    uint64_t v = double_bits(value);
+    if (!keys[k].seen) {
+        put_bits(chunk_data, &pos, now - chunk->start, 32);
+        put_bits(chunk_data, &pos, v, 64);
+        series_first_sample(&keys[k], now, v);
+    } else {
+        encode_time(chunk_data, &pos, &keys[k], now);
+        encode_value(chunk_data, &pos, &keys[k], v);
+    }
+
+    ++series_stats.samples;
+    series_stats.bits += pos - chunk->bits;
+    __atomic_store_n(&chunk->samples, chunk->samples + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&chunk->bits, pos, __ATOMIC_RELEASE);
+}
+
+void series_write_metrics() {
+    if (!opened)
+        return;
+
+    metrics_printf("# HELP mapper_devusb_series_samples_total Values stored "
+                   "in the time series\n");
+    metrics_printf("# TYPE mapper_devusb_series_samples_total counter\n");
+    metrics_printf("mapper_devusb_series_samples_total %lu\n",
+                   series_stats.samples);
+    metrics_printf("# HELP mapper_devusb_series_bytes_total Size of the "
+                   "records stored\n");
+    metrics_printf("# TYPE mapper_devusb_series_bytes_total counter\n");
+    metrics_printf("mapper_devusb_series_bytes_total %llu\n",
+                   (series_stats.bits + 7) / 8);
+    metrics_printf("# HELP mapper_devusb_series_chunks_total Chunk files "
+                   "created\n");
+    metrics_printf("# TYPE mapper_devusb_series_chunks_total counter\n");
+    metrics_printf("mapper_devusb_series_chunks_total %lu\n",
+                   series_stats.chunks);
+    if (series_stats.samples) {
+        metrics_printf("# HELP mapper_devusb_series_bits_per_sample Average "
+                       "size of a record\n");
+        metrics_printf("# TYPE mapper_devusb_series_bits_per_sample gauge\n");
+        metrics_printf("mapper_devusb_series_bits_per_sample %.2f\n",
+                       (double)series_stats.bits / series_stats.samples);
+    }
+}
@@ -0,0 +1,228 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * series.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SERIES_H
+#define SERIES_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Time series of the values read from the device (option series_dir), read by
+ * mapper-devusb-series.
+ *
+ * Samples go to chunk files <device basename>.<start, epoch msec>.series,
+ * append-only: a header with the keys, followed by a bit stream of records,
+ * one per sample:
+ *   - key index (SERIES_KEY_BITS bits)
+ *   - first sample of the key in the chunk: time since the chunk start (32
+ *     bits, msec), then the value (64 bits, IEEE 754)
+ *   - next samples: timestamp as a delta of delta (msec)
+ *       '0'                      same delta as before
+ *       '10'   + 7 bits          otherwise, two's complement
+ *       '110'  + 9 bits
+ *       '1110' + 12 bits
+ *       '1111' + 32 bits
+ *     then the value XORed with the previous one of the key
+ *       '0'                      same value
+ *       '10'   + meaningful bits same leading and trailing zeros window as
+ *                                the previous one, or narrower
+ *       '11'   + 5 bits leading zeros + 6 bits length - 1 + meaningful bits
+ * A sample takes 2 bytes when its value did not change and the board timer
+ * jitters by a few msec, about 9 bytes when the value changed.
+ *
+ * The daemon is the only writer, through a shared mapping. It writes the
+ * records first, then updates bits (and nb_keys), so readers can map a chunk
+ * being written and decode up to bits.
+*/
+
+#define SERIES_MAGIC   0x5354444d   // "MDTS"
+#define SERIES_VERSION 1
+
+#define SERIES_SUFFIX ".series"
+#define SERIES_DEFAULT_DIR "/var/lib/mapper-devusb"
+
+#define SERIES_KEY_BITS 6
+#define SERIES_MAX_KEYS (1 << SERIES_KEY_BITS)
+#define SERIES_KEY_MAX 32
+    // Header and data. Longer records do not exceed SERIES_RECORD_MAX bits.
+#define SERIES_CHUNK_SIZE (256 * 1024)
+#define SERIES_RECORD_MAX 128
+
+struct series_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;                  // sizeof(struct series_header)
+    uint32_t nb_keys;
+    char device[64];
+    uint64_t start;                 // Epoch msec
+    uint64_t bits;                  // Of data written
+    uint64_t samples;
+    char keys[SERIES_MAX_KEYS][SERIES_KEY_MAX + 1];
+};
+
+#define SERIES_DATA_BITS \
+    ((SERIES_CHUNK_SIZE - (uint64_t)sizeof(struct series_header)) * 8)
+
+    // Codec state of a key
+struct series_key {
+    int seen;
+    uint64_t time;                  // Epoch msec
+    int64_t delta;
+    uint64_t value;                 // Bits of the double
+    int leading;                    // -1 if no window yet
+    int trailing;
+};
+
+    // Number of bits of a delta of delta, per class: '0', '10', '110', '1110'
+    // and '1111'
+#define SERIES_DOD_CLASSES 5
+static inline int series_dod_bits(int c) {
+    static const int bits[SERIES_DOD_CLASSES] = { 0, 7, 9, 12, 32 };
+    return bits[c];
+}
+
+static inline void series_first_sample(struct series_key *k, uint64_t time,
+        uint64_t value) {
+    k->seen = 1;
+    k->time = time;
+    k->delta = 0;
+    k->value = value;
+    k->leading = -1;
+}
+
+    // Decoding of a chunk, mapped by the caller
+struct series_reader {
+    const struct series_header *header;
+    const uint8_t *data;
+    uint64_t bits;                  // Readable
+    uint64_t pos;
+    struct series_key keys[SERIES_MAX_KEYS];
+};
+
+    // Returns 0 if mapped (size bytes) is a chunk file, -1 otherwise
+static inline int series_reader_init(struct series_reader *r,
+        const void *mapped, uint64_t size) {
+    const struct series_header *h = mapped;
+    if (size < sizeof(*h) || h->magic != SERIES_MAGIC
+            || h->version != SERIES_VERSION || h->size != sizeof(*h))
+        return -1;
+    memset(r, 0, sizeof(*r));
+    r->header = h;
+    r->data = (const uint8_t *)mapped + sizeof(*h);
+        // Records and keys are complete up to there
+    r->bits = __atomic_load_n(&h->bits, __ATOMIC_ACQUIRE);
+    if (r->bits > (size - sizeof(*h)) * 8)
+        return -1;
+    return 0;
+}
+
+    // Bits are written and read most significant first. Past the readable
+    // bits (damaged file), sets pos beyond them.
+static inline uint64_t series_read_bits(struct series_reader *r, int n) {
+    if (r->pos + n > r->bits) {
+        r->pos = r->bits + 1;
+        return 0;
+    }
+    uint64_t v = 0;
+    for (int i = 0; i < n; ++i, ++r->pos)
+        v = (v << 1) | ((r->data[r->pos >> 3] >> (7 - (r->pos & 7))) & 1);
+    return v;
+}
+
+    // Returns 0 and the next sample if any, -1 at the end of the chunk
+static inline int series_next(struct series_reader *r, int *key,
+        uint64_t *time, double *value) {
+    if (r->pos >= r->bits)
+        return -1;
+
+    *key = series_read_bits(r, SERIES_KEY_BITS);
+    if (*key >= (int)r->header->nb_keys)
+        return -1;
+    struct series_key *k = &r->keys[*key];
+
+    if (!k->seen) {
+        uint64_t t = r->header->start + series_read_bits(r, 32);
+        series_first_sample(k, t, series_read_bits(r, 64));
+    } else {
+        int c = 0;
+        while (c < SERIES_DOD_CLASSES - 1 && series_read_bits(r, 1))
+            ++c;
+        int64_t dod = 0;
+        if (c) {
+            int n = series_dod_bits(c);
+            uint64_t m = 1ULL << (n - 1);
+            dod = (int64_t)((series_read_bits(r, n) ^ m) - m);
+        }
+        k->delta += dod;
+        k->time += k->delta;
+
+        if (series_read_bits(r, 1)) {
+            uint64_t x;
+            if (!series_read_bits(r, 1)) {
+                if (k->leading == -1)
+                    return -1;
+                x = series_read_bits(r, 64 - k->leading - k->trailing)
+                    << k->trailing;
+            } else {
+                k->leading = series_read_bits(r, 5);
+                int len = series_read_bits(r, 6) + 1;
+                if (len > 64 - k->leading)
+                    return -1;
+                k->trailing = 64 - k->leading - len;
+                x = series_read_bits(r, len) << k->trailing;
+            }
+            k->value ^= x;
+        }
+    }
+    if (r->pos > r->bits)
+        return -1;
+
+    *time = k->time;
+    memcpy(value, &k->value, sizeof(*value));
+    return 0;
+}
+
+    // Daemon side
+
+struct series_stats {
+    unsigned long samples;
+    unsigned long long bits;
+    unsigned long chunks;
+};
+
+extern struct series_stats series_stats;
+
+    // Chunks of device dev_file_name go to directory dir, a new one every
+    // chunk_sec seconds or when full. Returns 0 if success, -1 if failure
+    // (logged).
+int series_open(const char *dir, const char *dev_file_name, int chunk_sec);
+void series_close();
+    // Adds a sample at the current time
+void series_add(const char *key, double value);
+
+void series_write_metrics();
+
+#endif // SERIES_H
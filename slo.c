@@ -0,0 +1,164 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * slo.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "util.h"
+#include "metrics.h"
+#include "slo.h"
+
+    // The window is made of that many slices, the oldest one being dropped as
+    // time goes.
+#define NB_SLICES 10
+
+struct slice {
+    long long epoch;            // Slice number since clock origin
+    unsigned long total;
+    unsigned long missed;
+};
+
+static int enabled = 0;
+static long long latency_threshold;     // usec
+static double target;                   // Ratio, 0.99 for 99%
+static long long slice_usec;
+
+static struct slice slices[NB_SLICES];
+
+static int warned = 0;
+static long long last_warning = 0;
+static unsigned long nb_missed = 0;
+static unsigned long nb_total = 0;
+
+void slo_init(long latency_ms, double target_pct, int window_sec) {
+    latency_threshold = latency_ms * 1000LL;
+    target = target_pct / 100;
+    slice_usec = window_sec * 1000000LL / NB_SLICES;
+    if (slice_usec < 1)
+        slice_usec = 1;
+    for (int i = 0; i < NB_SLICES; ++i)
+        slices[i].epoch = -1;
+    enabled = 1;
+}
+
+static struct slice *current_slice(long long now) {
+    long long epoch = now / slice_usec;
+    struct slice *s = &slices[epoch % NB_SLICES];
+    if (s->epoch != epoch) {
+        s->epoch = epoch;
+        s->total = 0;
+        s->missed = 0;
+    }
+    return s;
+}
+
+void slo_record(long long now, long long latency_usec, int delivered) {
+    if (!enabled)
+        return;
+
+    struct slice *s = current_slice(now);
+    ++s->total;
+    ++nb_total;
+    if (!delivered || latency_usec > latency_threshold) {
+        ++s->missed;
+        ++nb_missed;
+    }
+}
+
+static void window(long long now, unsigned long *total,
+        unsigned long *missed) {
+    long long epoch = now / slice_usec;
+    *total = 0;
+    *missed = 0;
+    for (int i = 0; i < NB_SLICES; ++i) {
+        if (slices[i].epoch > epoch - NB_SLICES) {
+            *total += slices[i].total;
+            *missed += slices[i].missed;
+        }
+    }
+}
+
+    // How fast the error budget (1 - target) is consumed: 1 means exactly at
+    // the target, above means missing it.
+static double burn_rate(unsigned long total, unsigned long missed) {
+    if (!total)
+        return 0;
+    double budget = 1 - target;
+    double missed_ratio = (double)missed / total;
+    if (budget <= 0)
+        return (missed ? 1e9 : 0);
+    return missed_ratio / budget;
+}
+
+void slo_check(long long now) {
+    if (!enabled)
+        return;
+
+    unsigned long total;
+    unsigned long missed;
+    window(now, &total, &missed);
+    double burn = burn_rate(total, missed);
+
+    if (burn > 1) {
+        if (!warned || now - last_warning >= slice_usec * NB_SLICES) {
+            l("warning: slo: %lu/%lu message(s) not written within %lld ms "
+              "over the last %lld s, target is %.2f%%, burn rate %.1f",
+              missed, total,
+              latency_threshold / 1000, slice_usec * NB_SLICES / 1000000,
+              target * 100, burn);
+            warned = 1;
+            last_warning = now;
+        }
+    } else if (warned) {
+        l("slo: back within target, burn rate %.1f", burn);
+        warned = 0;
+    }
+}
+
+void slo_write_metrics() {
+    if (!enabled)
+        return;
+
+    unsigned long total;
+    unsigned long missed;
+    long long now = now_usec();
+    window(now, &total, &missed);
+
+    metrics_printf("# HELP mapper_devusb_slo_burn_rate Error budget "
+                   "consumption over the window, above 1 means target "
+                   "missed\n");
+    metrics_printf("# TYPE mapper_devusb_slo_burn_rate gauge\n");
+    metrics_printf("mapper_devusb_slo_burn_rate %.3f\n",
+                   burn_rate(total, missed));
+    metrics_printf("# HELP mapper_devusb_slo_window_messages Messages in the "
+                   "window\n");
+    metrics_printf("# TYPE mapper_devusb_slo_window_messages gauge\n");
+    metrics_printf("mapper_devusb_slo_window_messages %lu\n", total);
+    metrics_printf("# HELP mapper_devusb_slo_missed_total Messages that "
+                   "missed the latency objective\n");
+    metrics_printf("# TYPE mapper_devusb_slo_missed_total counter\n");
+    metrics_printf("mapper_devusb_slo_missed_total %lu\n", nb_missed);
+    metrics_printf("# HELP mapper_devusb_slo_messages_total Messages "
+                   "evaluated against the latency objective\n");
+    metrics_printf("# TYPE mapper_devusb_slo_messages_total counter\n");
+    metrics_printf("mapper_devusb_slo_messages_total %lu\n", nb_total);
+}
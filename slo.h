@@ -0,0 +1,49 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * slo.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SLO_H
+#define SLO_H
+
+/*
+ * Latency service level objective: slo_target percent of the messages must
+ * reach the device within slo_latency milliseconds of their reception on the
+ * FIFO, evaluated over a sliding window of slo_window seconds.
+ *
+ * A message whose write fails counts as missing the objective.
+*/
+
+    // Disabled unless called
+void slo_init(long latency_ms, double target_pct, int window_sec);
+
+    // latency_usec: from FIFO reception to end of the device write
+void slo_record(long long now, long long latency_usec, int delivered);
+
+    // Evaluates the window, logging a warning when the target gets missed
+    // (at most one per window) and a notice when it is met again.
+void slo_check(long long now);
+
+void slo_write_metrics();
+
+#endif // SLO_H
@@ -0,0 +1,210 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * stats.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "util.h"
+#include "stats.h"
+
+struct stats_file *stats = NULL;
+
+static void stats_begin() {
+    __atomic_store_n(&stats->seq, stats->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void stats_end() {
+    __atomic_store_n(&stats->seq, stats->seq + 1, __ATOMIC_RELEASE);
+}
+
+    // Single writer: no need for an atomic read-modify-write, only for the
+    // store not to tear.
+static void stats_add(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+    // Name of the stats file of device dev_file_name in directory dir:
+    // dir/<device basename>.stats
+static void stats_file_name(char *file_name, size_t len, const char *dir,
+        const char *dev_file_name) {
+    const char *base = strrchr(dev_file_name, '/');
+    base = (base ? base + 1 : dev_file_name);
+    snprintf(file_name, len, "%s/%s" STATS_SUFFIX, dir, base);
+}
+
+int stats_open(const char *dir, const char *dev_file_name) {
+    char file_name[PATH_MAX];
+    stats_file_name(file_name, sizeof(file_name), dir, dev_file_name);
+
+    int fd;
+    if ((fd = open(file_name, O_RDWR | O_CREAT, 0644)) == -1) {
+        l("error: cannot open '%s': %s", file_name, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || (st.st_size != sizeof(struct stats_file)
+            && ftruncate(fd, sizeof(struct stats_file)))) {
+        l("error: cannot size '%s': %s", file_name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    struct stats_file *s = mmap(NULL, sizeof(*s), PROT_READ | PROT_WRITE,
+                                MAP_SHARED, fd, 0);
+    close(fd);
+    if (s == MAP_FAILED) {
+        l("error: cannot map '%s': %s", file_name, strerror(errno));
+        return -1;
+    }
+
+        // File was extended by ftruncate(), with zeros
+    if (s->magic == STATS_MAGIC && s->version == 1
+            && s->size == STATS_V1_SIZE) {
+        s->version = STATS_VERSION;
+        s->size = sizeof(*s);
+        l("'%s': upgraded to version %d", file_name, STATS_VERSION);
+    }
+    if (s->magic != STATS_MAGIC || s->version != STATS_VERSION
+            || s->size != sizeof(*s)) {
+        if (st.st_size)
+            l("warning: '%s': unknown format, statistics reset", file_name);
+        memset(s, 0, sizeof(*s));
+        s->magic = STATS_MAGIC;
+        s->version = STATS_VERSION;
+        s->size = sizeof(*s);
+        s->created = time(NULL);
+    }
+        // A previous daemon may have died amid an update
+    s->seq &= ~1U;
+    s_strncpy(s->device, dev_file_name, sizeof(s->device));
+
+    stats = s;
+
+    stats_begin();
+    stats_add(&stats->starts, 1);
+    __atomic_store_n(&stats->updated, (uint64_t)time(NULL), __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->pid, (uint64_t)getpid(), __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->queued, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->queued_bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->failing_since, 0, __ATOMIC_RELAXED);
+    stats_end();
+
+    l("statistics file: '%s'", file_name);
+    return 0;
+}
+
+void stats_close() {
+    if (!stats)
+        return;
+
+    stats_begin();
+    __atomic_store_n(&stats->updated, (uint64_t)time(NULL), __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->pid, 0, __ATOMIC_RELAXED);
+    stats_end();
+
+    msync(stats, sizeof(*stats), MS_SYNC);
+    munmap(stats, sizeof(*stats));
+    stats = NULL;
+}
+
+void stats_message(size_t len) {
+    if (!stats)
+        return;
+    stats_begin();
+    stats_add(&stats->messages, 1);
+    stats_add(&stats->bytes_received, len);
+    stats_add(&stats->message_size[stats_bucket(len, STATS_SIZE_BUCKETS)], 1);
+    stats_end();
+}
+
+void stats_write(ssize_t written, long long usec) {
+    if (!stats)
+        return;
+    stats_begin();
+    if (written >= 0) {
+        stats_add(&stats->writes, 1);
+        stats_add(&stats->bytes_written, written);
+        stats_add(&stats->write_latency[
+                      stats_bucket(usec, STATS_LATENCY_BUCKETS)], 1);
+    } else {
+        stats_add(&stats->write_errors, 1);
+    }
+    stats_end();
+}
+
+void stats_keepalive() {
+    if (!stats)
+        return;
+    stats_begin();
+    stats_add(&stats->keepalives, 1);
+    __atomic_store_n(&stats->last_keepalive, (uint64_t)time(NULL),
+                     __ATOMIC_RELAXED);
+    stats_end();
+}
+
+void stats_failing() {
+    if (!stats)
+        return;
+    stats_begin();
+    __atomic_store_n(&stats->failing_since, (uint64_t)time(NULL),
+                     __ATOMIC_RELAXED);
+    stats_end();
+}
+
+void stats_reconnect(long long downtime_usec) {
+    if (!stats)
+        return;
+    stats_begin();
+    stats_add(&stats->reconnects, 1);
+    stats_add(&stats->downtime_usec, downtime_usec);
+    __atomic_store_n(&stats->failing_since, 0, __ATOMIC_RELAXED);
+    stats_end();
+}
+
+void stats_dropped() {
+    if (!stats)
+        return;
+    stats_begin();
+    stats_add(&stats->dropped, 1);
+    stats_end();
+}
+
+void stats_queue(unsigned long messages, unsigned long long bytes) {
+    if (!stats || (stats->queued == messages && stats->queued_bytes == bytes))
+        return;
+    stats_begin();
+    __atomic_store_n(&stats->queued, (uint64_t)messages, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->queued_bytes, (uint64_t)bytes, __ATOMIC_RELAXED);
+    stats_end();
+}
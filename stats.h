@@ -0,0 +1,134 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * stats.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+
+/*
+ * Cumulative per-device statistics, kept across restarts in a memory-mapped
+ * file (one per device, see option stats_dir), read by mapper-devusb-stat,
+ * along with the state of the running daemon, read by mapper-devusb-top.
+ *
+ * The daemon is the only writer. Readers don't lock anything: the writer
+ * makes seq odd while it updates the file, and readers retry their copy until
+ * they get it with the same even seq before and after.
+*/
+
+#define STATS_MAGIC   0x5355444d    // "MDUS"
+#define STATS_VERSION 2
+
+#define STATS_SUFFIX ".stats"
+#define STATS_DEFAULT_DIR "/var/lib/mapper-devusb"
+
+    // Histograms bucket i counts values v such that 2^i <= v < 2^(i+1) (bucket
+    // 0 also counts 0), last bucket counts everything above.
+#define STATS_LATENCY_BUCKETS 24    // usec, last one is >= 8 s
+#define STATS_SIZE_BUCKETS    16    // bytes, last one is >= 32 kB
+
+struct stats_file {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;                  // sizeof(struct stats_file)
+    uint32_t seq;
+    char device[64];
+
+    uint64_t created;               // Epoch
+    uint64_t updated;               // Epoch, time of last daemon start or stop
+    uint64_t starts;
+
+    uint64_t messages;
+    uint64_t bytes_received;
+    uint64_t bytes_written;
+    uint64_t writes;
+    uint64_t write_errors;
+    uint64_t keepalives;
+    uint64_t reconnects;
+    uint64_t downtime_usec;         // Time spent with the device failing
+
+    uint64_t write_latency[STATS_LATENCY_BUCKETS];
+    uint64_t message_size[STATS_SIZE_BUCKETS];
+
+        // Version 2
+    uint64_t dropped;               // Messages lost
+        // State of the running daemon
+    uint64_t pid;                   // 0 once stopped
+    uint64_t queued;                // Messages in the queue
+    uint64_t queued_bytes;
+    uint64_t failing_since;         // Epoch, 0 while writes succeed
+    uint64_t last_keepalive;        // Epoch
+};
+    // Version 1 files are the beginning of version 2 ones
+#define STATS_V1_SIZE offsetof(struct stats_file, dropped)
+
+static inline int stats_bucket(uint64_t v, int nb_buckets) {
+    int b = 0;
+    while (v >= 2 && b < nb_buckets - 1) {
+        v >>= 1;
+        ++b;
+    }
+    return b;
+}
+
+    // Consistent copy of the file, see the seq comment above.
+    // Returns 0 if success, -1 if the writer never got out of an update (it
+    // died meanwhile, the next daemon start will fix it).
+static inline int stats_snapshot(const struct stats_file *s,
+        struct stats_file *copy) {
+    for (int i = 0; i < 100000; ++i) {
+        uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+        memcpy(copy, (const void *)s, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq)
+            return 0;
+    }
+    return -1;
+}
+
+    // Daemon side. All calls are no-ops unless stats_open() succeeded.
+extern struct stats_file *stats;
+
+    // Maps (creating it if needed) the stats file of device dev_file_name in
+    // directory dir. Returns 0 if success, -1 if failure (logged).
+int stats_open(const char *dir, const char *dev_file_name);
+void stats_close();
+void stats_message(size_t len);
+    // written is -1 if the write failed
+void stats_write(ssize_t written, long long usec);
+void stats_keepalive();
+    // Writes started to fail
+void stats_failing();
+void stats_reconnect(long long downtime_usec);
+void stats_dropped();
+    // Does nothing if the queue did not change
+void stats_queue(unsigned long messages, unsigned long long bytes);
+
+#endif // STATS_H
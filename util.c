@@ -0,0 +1,192 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * util.c
+ *
+ * Copyright 2019, 2020 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Logging and string helpers, shared by mapper-devusb and microbench.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "util.h"
+
+int debug_on = 0;
+int log_usec = 0;
+
+FILE *flog = NULL;
+
+long long now_msec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long long now_usec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+long long wall_usec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void output_datetime_of_day(FILE *f) {
+    static int tz_ready = 0;
+
+    if (!f)
+        return;
+
+    struct timeval tv;
+    if (gettimeofday(&tv, NULL)) {
+        fprintf(f, "[gettimeofday(): error]  ");
+        return;
+    }
+
+        // localtime() checks the TZ variable (and allocates) at every call,
+        // localtime_r() relies on tzset() having been called once.
+    if (!tz_ready) {
+        tzset();
+        tz_ready = 1;
+    }
+    struct tm ts;
+    localtime_r(&tv.tv_sec, &ts);
+
+    if (log_usec) {
+        fprintf(f, "%02i/%02i/%02i %02i:%02i:%02i.%06lu ",
+                ts.tm_mday, ts.tm_mon + 1, ts.tm_year % 100,
+                ts.tm_hour, ts.tm_min, ts.tm_sec, tv.tv_usec);
+    } else {
+        fprintf(f, "%02i/%02i/%02i %02i:%02i:%02i ",
+                ts.tm_mday, ts.tm_mon + 1, ts.tm_year % 100,
+                ts.tm_hour, ts.tm_min, ts.tm_sec);
+    }
+}
+
+#ifdef DEBUG
+void DBG(const char *fmt, ...) {
+    if (!debug_on)
+        return;
+
+    if (!flog)
+        return;
+
+    output_datetime_of_day(flog);
+    fprintf(flog, "%s", "[D] ");
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(flog, fmt, args);
+    va_end(args);
+    fprintf(flog, "\n");
+    fflush(flog);
+}
+#endif
+
+void l(const char *fmt, ...) {
+    if (!flog)
+        return;
+
+    output_datetime_of_day(flog);
+    fprintf(flog, "%s", "    ");
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(flog, fmt, args);
+    va_end(args);
+    fprintf(flog, "\n");
+    fflush(flog);
+}
+
+void s_strncpy(char *dest, const char *src, size_t n) {
+    if (n >= 1) {
+        strncpy(dest, src, n - 1);
+        dest[n - 1] = '\0';
+    }
+}
+
+void remove_trailing_newline(char *s) {
+    size_t l = strlen(s);
+    if (l >= 1 && s[l - 1] == '\n')
+        s[--l] = '\0';
+    if (l >= 1 && s[l - 1] == '\r')
+        s[--l] = '\0';
+}
+
+int str_to_boolean(const char *s) {
+    if (!strcmp(s, "0") || !strcmp(s, "no") || !strcmp(s, "n")
+            || !strcmp(s, ""))
+        return 0;
+    return 1;
+}
+
+int get_field(const char *line, size_t len, int n, const char *separators,
+              char *out, size_t size) {
+    size_t i = 0;
+    for (int field = 1; ; ++field) {
+        while (i < len && strchr(separators, line[i]))
+            ++i;
+        if (i == len)
+            return -1;
+        size_t start = i;
+        while (i < len && !strchr(separators, line[i]))
+            ++i;
+        if (field == n) {
+            size_t l = i - start;
+            if (l >= size)
+                l = size - 1;
+            memcpy(out, line + start, l);
+            out[l] = '\0';
+            return 0;
+        }
+    }
+}
+
+char *trim(char *s) {
+    int p = strlen(s) - 1;
+    while (p >= 0 && (s[p] == ' ' || s[p] == '\t')) {
+        s[p] = '\0';
+        --p;
+    }
+    while (*s == ' ' || *s == '\t')
+        ++s;
+    return s;
+}
+
+int valid_name(const char *name, size_t max) {
+    size_t len = strlen(name);
+    if (!len || len > max)
+        return 0;
+    for (size_t i = 0; i < len; ++i) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+                || (c >= '0' && c <= '9') || c == '_' || c == '-'))
+            return 0;
+    }
+    return 1;
+}
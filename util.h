@@ -0,0 +1,69 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * util.h
+ *
+ * Copyright 2019, 2020 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdio.h>
+
+extern int debug_on;
+extern int log_usec;
+
+    // Log file, stderr if no log file is configured
+extern FILE *flog;
+
+    // Monotonic clock, in milliseconds and microseconds
+long long now_msec();
+long long now_usec();
+    // Wall clock, in microseconds
+long long wall_usec();
+
+void output_datetime_of_day(FILE *f);
+
+#ifdef DEBUG
+void DBG(const char *fmt, ...)
+     __attribute__((format(printf, 1, 2)));
+#else
+#define DBG(...)
+#endif
+
+void l(const char *fmt, ...)
+     __attribute__((format(printf, 1, 2)));
+
+void s_strncpy(char *dest, const char *src, size_t n);
+void remove_trailing_newline(char *s);
+char *trim(char *s);
+int str_to_boolean(const char *s);
+
+    // Copies field number n (1 for the first) of line to out, fields being
+    // separated by any character of separators. Returns 0 if there is one.
+int get_field(const char *line, size_t len, int n, const char *separators,
+              char *out, size_t size);
+
+    // Names given by clients (FIFOs, ptys) end up in file names and metric
+    // labels: 1 to max letters, digits, '_' or '-'. Returns 1 if name is one.
+int valid_name(const char *name, size_t max);
+
+#endif // UTIL_H
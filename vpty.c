@@ -0,0 +1,271 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * vpty.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "serial_speed.h"
+#include "util.h"
+#include "metrics.h"
+#include "devread.h"
+#include "vpty.h"
+
+struct vpty vptys[MAX_VPTYS];
+
+static char vpty_dir[PATH_MAX];
+static void (*message_handler)(struct vpty *p, char *buf, size_t len);
+    // Name of the pty of each slot
+static char ttys[MAX_VPTYS][32];
+
+void vpty_init(const char *dir,
+               void (*on_message)(struct vpty *p, char *buf, size_t len)) {
+    s_strncpy(vpty_dir, dir, sizeof(vpty_dir));
+    message_handler = on_message;
+    for (int i = 0; i < MAX_VPTYS; ++i)
+        vptys[i].master = -1;
+}
+
+void vpty_path(const struct vpty *p, char *path, size_t size) {
+    snprintf(path, size, "%s/%s.pty", vpty_dir, p->name);
+}
+
+const char *vpty_tty(const struct vpty *p) {
+    return ttys[p - vptys];
+}
+
+struct vpty *vpty_find(const char *name) {
+    for (int i = 0; i < MAX_VPTYS; ++i) {
+        if (vptys[i].master != -1 && !strcmp(vptys[i].name, name))
+            return &vptys[i];
+    }
+    return NULL;
+}
+
+struct vpty *vpty_open(const char *name) {
+    struct vpty *p;
+
+    if (!valid_name(name, VPTY_NAME_MAX)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((p = vpty_find(name)) != NULL)
+        return p;
+
+    for (p = vptys; p < vptys + MAX_VPTYS; ++p) {
+        if (p->master == -1)
+            break;
+    }
+    if (p == vptys + MAX_VPTYS) {
+        errno = EMFILE;
+        return NULL;
+    }
+
+    char *tty = ttys[p - vptys];
+    int master;
+    if ((master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC))
+            == -1)
+        return NULL;
+    int slave = -1;
+    struct termios term;
+    if (grantpt(master) || unlockpt(master)
+            || ptsname_r(master, tty, sizeof(ttys[0]))
+            || (slave = open(tty, O_RDWR | O_NOCTTY | O_CLOEXEC)) == -1
+            || tcgetattr(slave, &term)) {
+        int err = errno;
+        if (slave != -1)
+            close(slave);
+        close(master);
+        errno = err;
+        return NULL;
+    }
+        // Bytes go through as they are, no echo
+    cfmakeraw(&term);
+    cfsetspeed(&term, SERIAL_SPEED_SPEED_T);
+    tcsetattr(slave, TCSANOW, &term);
+        // Group members (the tools) may use it
+    chmod(tty, 0660);
+
+    s_strncpy(p->name, name, sizeof(p->name));
+    char path[PATH_MAX + VPTY_NAME_MAX + 8];
+    vpty_path(p, path, sizeof(path));
+    unlink(path);
+    if (symlink(tty, path)) {
+        int err = errno;
+        close(slave);
+        close(master);
+        errno = err;
+        return NULL;
+    }
+    p->master = master;
+    p->slave = slave;
+    p->frame_len = 0;
+    p->messages = 0;
+    p->bytes = 0;
+    p->lines = 0;
+    p->dropped = 0;
+    l("pty '%s' created (%s)", path, tty);
+
+    return p;
+}
+
+void vpty_close(struct vpty *p) {
+    char path[PATH_MAX + VPTY_NAME_MAX + 8];
+    vpty_path(p, path, sizeof(path));
+    unlink(path);
+    close(p->slave);
+    close(p->master);
+    p->master = -1;
+    l("pty '%s' removed (%lu message(s), %lu bytes, %lu line(s) written, "
+      "%lu lost)", path, p->messages, p->bytes, p->lines, p->dropped);
+}
+
+void vpty_close_all() {
+    for (int i = 0; i < MAX_VPTYS; ++i) {
+        if (vptys[i].master != -1)
+            vpty_close(&vptys[i]);
+    }
+}
+
+int vpty_fds(fd_set *rfds) {
+    int max_fd = -1;
+    for (int i = 0; i < MAX_VPTYS; ++i) {
+        int fd = vptys[i].master;
+        if (fd == -1)
+            continue;
+        FD_SET(fd, rfds);
+        if (fd > max_fd)
+            max_fd = fd;
+    }
+    return max_fd;
+}
+
+    // Hands the line being received over, if not empty
+static void end_frame(struct vpty *p) {
+    if (!p->frame_len)
+        return;
+    p->frame[p->frame_len++] = '\n';
+    ++p->messages;
+    p->bytes += p->frame_len;
+    message_handler(p, p->frame, p->frame_len);
+    p->frame_len = 0;
+}
+
+void vpty_feed(struct vpty *p, const char *buf, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (buf[i] == '\n' || buf[i] == '\r') {
+            end_frame(p);
+        } else {
+                // Room for the \n
+            if (p->frame_len == sizeof(p->frame) - 1)
+                end_frame(p);
+            p->frame[p->frame_len++] = buf[i];
+        }
+    }
+}
+
+static void receive(struct vpty *p) {
+    char buf[VPTY_FRAME_MAX];
+    ssize_t n;
+        // One read per loop iteration, as for FIFOs
+    if ((n = read(p->master, buf, sizeof(buf))) > 0)
+        vpty_feed(p, buf, n);
+}
+
+void vpty_handle(fd_set *rfds) {
+    for (int i = 0; i < MAX_VPTYS; ++i) {
+        struct vpty *p = &vptys[i];
+        if (p->master != -1 && FD_ISSET(p->master, rfds))
+            receive(p);
+    }
+}
+
+void vpty_publish(const char *line, size_t len) {
+    char buf[DEVREAD_LINE_MAX + 2];
+    if (len > DEVREAD_LINE_MAX)
+        len = DEVREAD_LINE_MAX;
+    memcpy(buf, line, len);
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    for (int i = 0; i < MAX_VPTYS; ++i) {
+        struct vpty *p = &vptys[i];
+        if (p->master == -1)
+            continue;
+        ssize_t n = write(p->master, buf, len);
+        if (n == (ssize_t)len) {
+            ++p->lines;
+        } else {
+                // Nobody reads it: what is pending is stale, start afresh
+            ++p->dropped;
+            tcflush(p->slave, TCIFLUSH);
+        }
+    }
+}
+
+void vpty_write_metrics() {
+    static const struct {
+        const char *name;
+        const char *help;
+        size_t offset;
+    } counters[] = {
+        { "pty_messages_total", "Messages received on ptys",
+          offsetof(struct vpty, messages) },
+        { "pty_received_bytes_total", "Bytes received on ptys",
+          offsetof(struct vpty, bytes) },
+        { "pty_lines_total", "Device lines written to ptys",
+          offsetof(struct vpty, lines) },
+        { "pty_dropped_total", "Device lines not written to ptys, tool not "
+          "keeping up", offsetof(struct vpty, dropped) }
+    };
+    for (size_t k = 0; k < sizeof(counters) / sizeof(*counters); ++k) {
+        int header = 0;
+        for (int i = 0; i < MAX_VPTYS; ++i) {
+            const struct vpty *p = &vptys[i];
+            if (p->master == -1)
+                continue;
+            if (!header) {
+                metrics_printf("# HELP mapper_devusb_%s %s\n",
+                               counters[k].name, counters[k].help);
+                metrics_printf("# TYPE mapper_devusb_%s counter\n",
+                               counters[k].name);
+                header = 1;
+            }
+            metrics_printf("mapper_devusb_%s{pty=\"%s\"} %lu\n",
+                           counters[k].name, p->name,
+                           *(const unsigned long *)((const char *)p
+                                                    + counters[k].offset));
+        }
+    }
+}
@@ -0,0 +1,97 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * vpty.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef VPTY_H
+#define VPTY_H
+
+#include <stddef.h>
+#include <sys/select.h>
+
+#include "client_fifo.h"
+
+/*
+ * Pseudo-terminals created on request (control command pty), for tools that
+ * need a tty (serial monitors...) to talk to the board without opening the
+ * device, which would reset it.
+ *
+ * What a tool writes to its pty is cut in lines (ended by \n or \r), each
+ * line being a message forwarded to the device like those of the FIFOs,
+ * queue included. Every line read from the device (option read_device) is
+ * written to all ptys, ended by \r\n as the board does. A pty whose tool does
+ * not keep up loses lines, it does not slow the daemon down.
+ *
+ * The pty is reached by the symbolic link <name>.pty, in the directory of the
+ * control socket. The daemon keeps the terminal side open as well, so that
+ * tools can come and go.
+*/
+
+#define MAX_VPTYS 8
+#define VPTY_NAME_MAX CLIENT_FIFO_NAME_MAX
+#define VPTY_FRAME_MAX 1024
+
+struct vpty {
+    char name[VPTY_NAME_MAX + 1];
+    int master;                 // -1 if the slot is free
+    int slave;
+    char frame[VPTY_FRAME_MAX];
+    size_t frame_len;           // Line being received
+    unsigned long messages;
+    unsigned long bytes;
+    unsigned long lines;        // Written to the pty
+    unsigned long dropped;      // Not written, tool not keeping up
+};
+
+extern struct vpty vptys[MAX_VPTYS];
+
+    // on_message gets every line a tool writes, ended by \n
+void vpty_init(const char *dir,
+               void (*on_message)(struct vpty *p, char *buf, size_t len));
+
+    // Creates pty name, returns it (or the existing one), NULL on error (errno
+    // set)
+struct vpty *vpty_open(const char *name);
+struct vpty *vpty_find(const char *name);
+void vpty_close(struct vpty *p);
+void vpty_close_all();
+
+    // Path of the symbolic link, and of the pty it points to
+void vpty_path(const struct vpty *p, char *path, size_t size);
+const char *vpty_tty(const struct vpty *p);
+
+    // Adds the ptys to watch to rfds, returns the highest one, -1 if none
+int vpty_fds(fd_set *rfds);
+void vpty_handle(fd_set *rfds);
+    // Cuts n bytes read from pty p in messages, see vpty_init(). Used by
+    // vpty_handle(), public for microbench.
+void vpty_feed(struct vpty *p, const char *buf, size_t n);
+
+    // Writes a line read from the device (without its end of line) to every
+    // pty
+void vpty_publish(const char *line, size_t len);
+
+void vpty_write_metrics();
+
+#endif // VPTY_H
@@ -0,0 +1,111 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * worker.c
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <errno.h>
+
+#include "worker.h"
+
+#define QUEUE_SIZE 8
+
+struct task {
+    void (*func)(void *);
+    void *arg;
+};
+
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static struct task queue[QUEUE_SIZE];
+static unsigned head = 0;       // Next task to run
+static unsigned tail = 0;       // Next free slot
+static int running = 0;
+static int stopping = 0;
+
+static void *worker_main(void *unused) {
+    (void)unused;
+
+    pthread_mutex_lock(&lock);
+    while (1) {
+        while (head == tail && !stopping)
+            pthread_cond_wait(&cond, &lock);
+        if (head == tail)
+            break;
+        struct task t = queue[head % QUEUE_SIZE];
+        ++head;
+        pthread_mutex_unlock(&lock);
+        t.func(t.arg);
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+
+    return NULL;
+}
+
+int worker_start() {
+    int err;
+    if ((err = pthread_create(&thread, NULL, worker_main, NULL))) {
+        errno = err;
+        return -1;
+    }
+    running = 1;
+    return 0;
+}
+
+int worker_submit(void (*func)(void *), void *arg) {
+    if (!running)
+        return -1;
+
+    pthread_mutex_lock(&lock);
+    if (tail - head >= QUEUE_SIZE) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    queue[tail % QUEUE_SIZE].func = func;
+    queue[tail % QUEUE_SIZE].arg = arg;
+    ++tail;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+
+    return 0;
+}
+
+void worker_stop() {
+    if (!running)
+        return;
+
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+
+    pthread_join(thread, NULL);
+    running = 0;
+}
+
+int worker_running() {
+    return running;
+}
@@ -0,0 +1,49 @@
+// vim: ts=4:sw=4:et:tw=80
+
+/*
+ * worker.h
+ *
+ * Copyright 2026 Sébastien Millet
+ *
+*/
+
+/*
+  This file is part of mapper-devusb.
+
+  mapper-devusb is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  mapper-devusb is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  mapper-devusb. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef WORKER_H
+#define WORKER_H
+
+/*
+ * Background thread for tasks that may block on disk (metrics file writing),
+ * so that they do not delay forwarding to the device. Device writes stay in
+ * the event loop, in order.
+ *
+ * Tasks must not call l(): they report to the loop instead.
+*/
+
+    // Returns 0 if the thread could be started, -1 otherwise (errno set)
+int worker_start();
+
+    // Returns 0 if the task got queued, -1 if the worker is not running or its
+    // queue is full, the caller then runs the task itself.
+int worker_submit(void (*func)(void *), void *arg);
+
+    // Runs the tasks left, then stops the thread
+void worker_stop();
+
+int worker_running();
+
+#endif // WORKER_H
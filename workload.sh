@@ -0,0 +1,46 @@
+#!/bin/sh
+
+#
+# Copyright 2026 Sébastien Millet
+#
+
+# Runs mapper-devusb of BUILD_DIR under a synthetic workload: devsim (pty
+# standing in for the Arduino board) sends RATE commands per second through the
+# FIFO for DURATION_MS milliseconds.
+#
+# Prints the number of commands that reached the device, and the CPU time
+# (milliseconds, user + system) the daemon used.
+#
+# Usage:
+#   ./workload.sh BUILD_DIR [DURATION_MS [RATE]]
+
+set -eu
+
+BUILD=$1
+DURATION=${2:-10000}
+RATE=${3:-2000}
+
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+mkfifo "$WORKDIR/fifo"
+echo "log_usec = yes" > "$WORKDIR/conf"
+
+"$BUILD/mapper-devusb" -c "$WORKDIR/conf" -f "$WORKDIR/fifo" \
+    -l "$WORKDIR/log" "$WORKDIR/tty" &
+pid=$!
+
+"$BUILD/devsim" -f "$WORKDIR/fifo" -r "$RATE" -t "$DURATION" -g 500 \
+    "$WORKDIR/tty" > "$WORKDIR/report"
+
+    # Fields 14 and 15 of /proc/PID/stat: user and system time, in clock ticks
+cpu_ms=$(awk -v hz="$(getconf CLK_TCK)" '{ print ($14 + $15) * 1000 / hz }' \
+    "/proc/$pid/stat")
+
+echo "EOF()" > "$WORKDIR/fifo"
+wait $pid || true
+
+received=$(sed -n 's/^total: sent [0-9]*, received \([0-9]*\),.*/\1/p' \
+    "$WORKDIR/report")
+
+echo "$received $cpu_ms"